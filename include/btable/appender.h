@@ -0,0 +1,190 @@
+#pragma once
+
+#include "btable.h"
+
+#include <atomic>
+#include <memory>
+
+// Lets many threads append entries to a pre-sized table without locks. Producers reserve
+// disjoint entry ranges with reserve(), write their column slices directly and call
+// publish(). getPublishedEntries() is a watermark below which every entry is complete;
+// it advances per block of block_size entries, and to the last reserved entry whenever
+// every reservation has been published.
+// Nullable, list and bit-packed columns are not supported: neighbouring validity and
+// BOOL bits share bytes and list entries have to be written in order. Check supports()
+// first, an appender for an unsupported table has capacity 0 and reserves nothing.
+class BTableAppender
+{
+public:
+	static constexpr uint32_t block_size = 4096;
+
+	static bool supports(const BTable& table)
+	{
+		for (uint32_t i = 0; i < table.getNumFields(); i++)
+		{
+			if(!supports(table.getField(i)))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static bool supports(const BTable::FieldListEntry* field)
+	{
+		return !BTable::isNullable(field) && !BTable::isList(field) && !BTable::isBitPacked(BTable::getFieldDataType(field));
+	}
+
+	// The table's numEntries is the capacity
+	BTableAppender(BTable& table) :
+		m_table(table),
+		m_capacity(supports(table) ? table.getNumEntries() : 0),
+		m_numBlocks((m_capacity + block_size - 1) / block_size),
+		m_blocks(new std::atomic<uint32_t>[m_numBlocks])
+	{
+		for (uint32_t i = 0; i < m_numBlocks; i++)
+		{
+			m_blocks[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	BTableAppender(const BTableAppender&) = delete;
+	BTableAppender& operator=(const BTableAppender&) = delete;
+
+	// Returns the first of n consecutive entries, or (uint32_t)-1 if the table is full
+	uint32_t reserve(uint32_t n)
+	{
+		uint32_t first = m_reserved.load(std::memory_order_relaxed);
+		do
+		{
+			if((uint64_t)first + n > m_capacity)
+			{
+				return (uint32_t)-1;
+			}
+		}
+		while(!m_reserved.compare_exchange_weak(first, first + n, std::memory_order_seq_cst, std::memory_order_relaxed));
+		return first;
+	}
+
+	// Start of the slice of a column for entries from firstEntry on, nullptr for unsupported columns
+	void* getColumn(const BTable::FieldListEntry* field, uint32_t firstEntry)
+	{
+		if(!supports(field))
+		{
+			return nullptr;
+		}
+		return (unsigned char*)m_table.getEntries(field) + (size_t)firstEntry * BTable::getBytesPerEntry(field);
+	}
+
+	// Marks a reserved range as written. Returns false without publishing anything if the
+	// range is not reserved or more entries would be published than are reserved, e.g.
+	// when a range is published twice
+	bool publish(uint32_t first, uint32_t n)
+	{
+		if((uint64_t)first + n > getReservedEntries())
+		{
+			return false;
+		}
+		uint32_t completed = m_completed.load(std::memory_order_seq_cst);
+		do
+		{
+			// Reserved is read after completed, so it covers every range already counted
+			if((uint64_t)completed + n > m_reserved.load(std::memory_order_seq_cst))
+			{
+				return false;
+			}
+		}
+		while(!m_completed.compare_exchange_weak(completed, completed + n, std::memory_order_seq_cst, std::memory_order_seq_cst));
+
+		uint32_t end = first + n;
+		while(first < end)
+		{
+			uint32_t block = first / block_size;
+			uint32_t blockEnd = (block + 1) * block_size < end ? (block + 1) * block_size : end;
+			m_blocks[block].fetch_add(blockEnd - first, std::memory_order_seq_cst);
+			first = blockEnd;
+		}
+		advanceWatermark();
+		return true;
+	}
+
+	// Entries below this are complete and may be read
+	uint32_t getPublishedEntries() const
+	{
+		return m_published.load(std::memory_order_acquire);
+	}
+
+	uint32_t getReservedEntries() const
+	{
+		return m_reserved.load(std::memory_order_acquire);
+	}
+
+	uint32_t getCapacity() const
+	{
+		return m_capacity;
+	}
+
+	BTable& getTable()
+	{
+		return m_table;
+	}
+
+	// Once all producers are done, shrinks the table's numEntries to the published entries.
+	// Column offsets stay as they are, so the buffer size does not change.
+	// Returns false if a reservation is unpublished or the table is not supported
+	bool finish()
+	{
+		uint32_t published = getPublishedEntries();
+		if(published != getReservedEntries() || !supports(m_table))
+		{
+			return false;
+		}
+		m_table.getHeader()->numEntries = BTable::cpu_to_be32(published);
+		return true;
+	}
+
+private:
+	uint32_t getBlockEntries(uint32_t block) const
+	{
+		uint32_t remaining = m_capacity - block * block_size;
+		return remaining < block_size ? remaining : block_size;
+	}
+
+	void advanceWatermark()
+	{
+		// Completed is read before reserved: if they match, every reserved entry is written.
+		// Publishers store their counts and then load the others' (store buffering), so these
+		// are seq_cst: the last of two concurrent publishers is guaranteed to see both
+		uint32_t completed = m_completed.load(std::memory_order_seq_cst);
+		uint32_t reserved = m_reserved.load(std::memory_order_seq_cst);
+		uint32_t current = m_published.load(std::memory_order_acquire);
+
+		uint32_t target = current;
+		if(completed == reserved)
+		{
+			target = reserved;
+		}
+		else
+		{
+			uint32_t block = current / block_size;
+			while(block < m_numBlocks && m_blocks[block].load(std::memory_order_seq_cst) == getBlockEntries(block))
+			{
+				block++;
+			}
+			uint32_t blocksEnd = block * block_size < m_capacity ? block * block_size : m_capacity;
+			target = blocksEnd > current ? blocksEnd : current;
+		}
+
+		while(target > current && !m_published.compare_exchange_weak(current, target, std::memory_order_acq_rel, std::memory_order_acquire))
+		{
+		}
+	}
+
+	BTable& m_table;
+	uint32_t m_capacity;
+	uint32_t m_numBlocks;
+	std::unique_ptr<std::atomic<uint32_t>[]> m_blocks; // Entries written per block
+	std::atomic<uint32_t> m_reserved{ 0 };
+	std::atomic<uint32_t> m_completed{ 0 };
+	std::atomic<uint32_t> m_published{ 0 };
+};
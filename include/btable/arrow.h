@@ -0,0 +1,460 @@
+#pragma once
+
+#include "btable.h"
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Arrow C Data Interface, https://arrow.apache.org/docs/format/CDataInterface.html
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema
+{
+	const char* format;
+	const char* name;
+	const char* metadata;
+	int64_t flags;
+	int64_t n_children;
+	struct ArrowSchema** children;
+	struct ArrowSchema* dictionary;
+	void (*release)(struct ArrowSchema*);
+	void* private_data;
+};
+
+struct ArrowArray
+{
+	int64_t length;
+	int64_t null_count;
+	int64_t offset;
+	int64_t n_buffers;
+	int64_t n_children;
+	const void** buffers;
+	struct ArrowArray** children;
+	struct ArrowArray* dictionary;
+	void (*release)(struct ArrowArray*);
+	void* private_data;
+};
+
+#endif
+
+// Export of table columns as Arrow arrays and import of Arrow arrays into table columns.
+// Exported buffers point into the table where possible (native byte order and values
+// aligned to their size), so the table buffer has to outlive the exported arrays.
+// Single value columns map to primitive arrays, fixed size arrays to "+w:N" and list
+// columns to "+l". Validity bitmaps are shared as they already use the Arrow layout.
+struct BTableArrow
+{
+	template <typename Table>
+	static const char* getFormat(typename Table::DataType dataType)
+	{
+		switch (dataType)
+		{
+		case Table::INT8: return "c";
+		case Table::INT16: return "s";
+		case Table::INT32: return "i";
+		case Table::INT64: return "l";
+		case Table::FLOAT32: return "f";
+		case Table::FLOAT64: return "g";
+		case Table::BOOL: return "b";
+		case Table::FLOAT16: return "e";
+		case Table::UINT8: return "C";
+		case Table::UINT16: return "S";
+		case Table::UINT32: return "I";
+		case Table::UINT64: return "L";
+		default: return nullptr; // BFLOAT16 has no Arrow type
+		}
+	}
+
+	// Exports one column, name may be nullptr. Returns false for unsupported columns
+	template <typename Table>
+	static bool exportColumn(const Table& table, const typename Table::FieldListEntry* field, ArrowSchema* schema, ArrowArray* array, const char* name = nullptr)
+	{
+		typename Table::DataType dataType = Table::getFieldDataType(field);
+		const char* format = getFormat<Table>(dataType);
+		if(!format)
+		{
+			return false;
+		}
+
+		uint32_t numEntries = table.getNumEntries();
+		uint32_t valueSize = Table::getDatatypeSize(dataType);
+		bool swap = table.needsByteswap();
+		const uint8_t* validity = table.getValidityBitmap(field);
+		int64_t nullCount = validity ? numEntries - table.countValid(field) : 0;
+
+		if(Table::isList(field))
+		{
+			uint32_t count;
+			const void* values = table.getListValues(field, &count);
+			if(count > INT32_MAX)
+			{
+				return false;
+			}
+			const void* offsets = (const unsigned char*)table.getEntries(field) + 4;
+
+			initSchema(schema, "+l", name, validity != nullptr);
+			addChildSchema(schema, format, "item");
+			ArrayData* data = initArray(array, numEntries, nullCount, 2);
+			data->buffers[0] = validity;
+			data->buffers[1] = exportBuffer(data, offsets, numEntries + 1, 4, swap);
+			addChildArray(array, values, count, valueSize, swap);
+			return true;
+		}
+
+		const void* values = table.getValuePtr(field, 0);
+		if(field->arraySize > 1)
+		{
+			std::string fixedFormat = "+w:" + std::to_string(field->arraySize);
+			initSchema(schema, fixedFormat.c_str(), name, validity != nullptr);
+			addChildSchema(schema, format, "item");
+			ArrayData* data = initArray(array, numEntries, nullCount, 1);
+			data->buffers[0] = validity;
+			addChildArray(array, values, numEntries * field->arraySize, valueSize, swap);
+			return true;
+		}
+
+		initSchema(schema, format, name, validity != nullptr);
+		ArrayData* data = initArray(array, numEntries, nullCount, 2);
+		data->buffers[0] = validity;
+		data->buffers[1] = exportBuffer(data, values, numEntries, valueSize, swap);
+		return true;
+	}
+
+	// Exports all columns as a struct array. names may be nullptr or hold one name per field
+	template <typename Table>
+	static bool exportTable(const Table& table, ArrowSchema* schema, ArrowArray* array, const char* const* names = nullptr)
+	{
+		uint32_t numFields = table.getNumFields();
+		initSchema(schema, "+s", nullptr, false);
+		ArrayData* data = initArray(array, table.getNumEntries(), 0, 1);
+		data->buffers[0] = nullptr;
+
+		SchemaData* schemaData = (SchemaData*)schema->private_data;
+		for (uint32_t i = 0; i < numFields; i++)
+		{
+			ArrowSchema* childSchema = new ArrowSchema();
+			ArrowArray* childArray = new ArrowArray();
+			schemaData->children.push_back(childSchema);
+			data->children.push_back(childArray);
+			if(!exportColumn(table, table.getField(i), childSchema, childArray, names ? names[i] : nullptr))
+			{
+				schemaData->children.pop_back();
+				data->children.pop_back();
+				delete childSchema;
+				delete childArray;
+				schema->release(schema);
+				array->release(array);
+				return false;
+			}
+		}
+		schema->n_children = numFields;
+		schema->children = schemaData->children.data();
+		array->n_children = numFields;
+		array->children = data->children.data();
+		return true;
+	}
+
+	// Fills a field description matching an Arrow array, e.g. to size and init a table for
+	// importColumn(). field->name points into schema
+	template <typename Table>
+	static bool getFieldData(const ArrowSchema* schema, const ArrowArray* array, typename Table::FieldData* field)
+	{
+		field->name = schema->name ? schema->name : "";
+		field->nullable = (schema->flags & ARROW_FLAG_NULLABLE) != 0;
+		field->arraySize = 1;
+		field->list = false;
+		field->listCapacity = 0;
+
+		const char* format = schema->format;
+		if(strcmp(format, "+l") == 0 || strncmp(format, "+w:", 3) == 0)
+		{
+			if(schema->n_children != 1 || array->n_children != 1)
+			{
+				return false;
+			}
+			if(format[1] == 'l')
+			{
+				int64_t capacity = array->children[0]->length;
+				if(capacity < 0 || capacity > UINT32_MAX)
+				{
+					return false;
+				}
+				field->list = true;
+				field->listCapacity = (uint32_t)capacity;
+			}
+			else
+			{
+				char* end;
+				long arraySize = strtol(format + 3, &end, 10);
+				if(*end != '\0' || arraySize < 1 || arraySize > 255)
+				{
+					return false;
+				}
+				field->arraySize = (uint8_t)arraySize;
+			}
+			format = schema->children[0]->format;
+		}
+		return parseFormat<Table>(format, &field->dataType);
+	}
+
+	// Copies an Arrow array into an existing column of the same type and shape.
+	// The array has to have getNumEntries() elements and stays owned by the caller
+	template <typename Table>
+	static bool importColumn(Table& table, const typename Table::FieldListEntry* field, const ArrowSchema* schema, const ArrowArray* array)
+	{
+		uint32_t numEntries = table.getNumEntries();
+		typename Table::FieldData expected;
+		if(array->length != numEntries || !getFieldData<Table>(schema, array, &expected))
+		{
+			return false;
+		}
+		typename Table::DataType dataType = Table::getFieldDataType(field);
+		if(expected.dataType != dataType || expected.list != Table::isList(field) || (!expected.list && expected.arraySize != field->arraySize))
+		{
+			return false;
+		}
+
+		const uint8_t* validity = array->null_count != 0 ? (const uint8_t*)array->buffers[0] : nullptr;
+		if(validity && !Table::isNullable(field))
+		{
+			return false;
+		}
+
+		uint32_t valueSize = Table::getDatatypeSize(dataType);
+		bool swap = table.needsByteswap();
+		if(Table::isList(field))
+		{
+			const ArrowArray* child = array->children[0];
+			const int32_t* offsets = (const int32_t*)array->buffers[1] + array->offset;
+			const unsigned char* values = (const unsigned char*)child->buffers[1] + child->offset * valueSize;
+			// Offsets index the child array and have to be ascending within its bounds
+			if(offsets[0] < 0)
+			{
+				return false;
+			}
+			for (uint32_t i = 0; i < numEntries; i++)
+			{
+				if(offsets[i + 1] < offsets[i])
+				{
+					return false;
+				}
+			}
+			if(offsets[numEntries] > child->length)
+			{
+				return false;
+			}
+			for (uint32_t i = 0; i < numEntries; i++)
+			{
+				uint32_t n = offsets[i + 1] - offsets[i];
+				if(!table.setList(field, i, values + (size_t)offsets[i] * valueSize, n))
+				{
+					return false;
+				}
+				if(swap)
+				{
+					uint32_t size;
+					swapElements((unsigned char*)table.getList(field, i, &size), n, valueSize);
+				}
+			}
+		}
+		else
+		{
+			const unsigned char* values;
+			int64_t valueOffset;
+			uint32_t count = numEntries * field->arraySize;
+			if(field->arraySize > 1)
+			{
+				const ArrowArray* child = array->children[0];
+				values = (const unsigned char*)child->buffers[1];
+				valueOffset = child->offset + array->offset * field->arraySize;
+			}
+			else
+			{
+				values = (const unsigned char*)array->buffers[1];
+				valueOffset = array->offset;
+			}
+			unsigned char* dst = (unsigned char*)table.getEntries(field);
+			if(Table::isBitPacked(dataType))
+			{
+				// Offsets are in bits and need not be byte aligned
+				for (uint32_t i = 0; i < count; i++)
+				{
+					BTableBitmap::set(dst, i, BTableBitmap::get(values, (uint32_t)(valueOffset + i)));
+				}
+			}
+			else
+			{
+				memcpy(dst, values + valueOffset * valueSize, (size_t)count * valueSize);
+				if(swap)
+				{
+					swapElements(dst, count, valueSize);
+				}
+			}
+		}
+
+		if(Table::isNullable(field))
+		{
+			for (uint32_t i = 0; i < numEntries; i++)
+			{
+				table.setValid(field, i, !validity || BTableBitmap::get(validity, (uint32_t)array->offset + i));
+			}
+		}
+		return true;
+	}
+
+private:
+	struct SchemaData
+	{
+		std::string format;
+		std::string name;
+		std::vector<ArrowSchema*> children;
+	};
+
+	struct ArrayData
+	{
+		const void* buffers[2];
+		std::vector<std::unique_ptr<unsigned char[]>> owned;
+		std::vector<ArrowArray*> children;
+	};
+
+	template <typename Table>
+	static bool parseFormat(const char* format, typename Table::DataType* dataType)
+	{
+		for (int type = Table::INT8; type <= Table::UINT64; type++)
+		{
+			const char* candidate = getFormat<Table>((typename Table::DataType)type);
+			if(candidate && strcmp(candidate, format) == 0)
+			{
+				*dataType = (typename Table::DataType)type;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static void swapElements(unsigned char* values, uint32_t count, uint32_t valueSize)
+	{
+		for (uint32_t i = 0; i < count; i++)
+		{
+			unsigned char* value = values + (size_t)i * valueSize;
+			for (uint32_t lo = 0, hi = valueSize - 1; lo < hi; lo++, hi--)
+			{
+				unsigned char tmp = value[lo];
+				value[lo] = value[hi];
+				value[hi] = tmp;
+			}
+		}
+	}
+
+	// Zero-copy if the values are in native byte order and aligned, otherwise a converted copy
+	static const void* exportBuffer(ArrayData* data, const void* values, uint32_t count, uint32_t valueSize, bool swap)
+	{
+		// Bit-packed (valueSize 0) and byte values are shared as they are
+		if(valueSize <= 1 || (!swap && (uintptr_t)values % valueSize == 0))
+		{
+			return values;
+		}
+		size_t size = (size_t)count * valueSize;
+		unsigned char* copy = new unsigned char[size > 0 ? size : 1];
+		memcpy(copy, values, size);
+		if(swap)
+		{
+			swapElements(copy, count, valueSize);
+		}
+		data->owned.emplace_back(copy);
+		return copy;
+	}
+
+	static void initSchema(ArrowSchema* schema, const char* format, const char* name, bool nullable)
+	{
+		SchemaData* data = new SchemaData();
+		data->format = format;
+		data->name = name ? name : "";
+		schema->format = data->format.c_str();
+		schema->name = name ? data->name.c_str() : nullptr;
+		schema->metadata = nullptr;
+		schema->flags = nullable ? ARROW_FLAG_NULLABLE : 0;
+		schema->n_children = 0;
+		schema->children = nullptr;
+		schema->dictionary = nullptr;
+		schema->release = releaseSchema;
+		schema->private_data = data;
+	}
+
+	static void addChildSchema(ArrowSchema* schema, const char* format, const char* name)
+	{
+		SchemaData* data = (SchemaData*)schema->private_data;
+		ArrowSchema* child = new ArrowSchema();
+		initSchema(child, format, name, false);
+		data->children.push_back(child);
+		schema->n_children = 1;
+		schema->children = data->children.data();
+	}
+
+	static ArrayData* initArray(ArrowArray* array, int64_t length, int64_t nullCount, int64_t numBuffers)
+	{
+		ArrayData* data = new ArrayData();
+		data->buffers[0] = nullptr;
+		data->buffers[1] = nullptr;
+		array->length = length;
+		array->null_count = nullCount;
+		array->offset = 0;
+		array->n_buffers = numBuffers;
+		array->n_children = 0;
+		array->buffers = data->buffers;
+		array->children = nullptr;
+		array->dictionary = nullptr;
+		array->release = releaseArray;
+		array->private_data = data;
+		return data;
+	}
+
+	static void addChildArray(ArrowArray* array, const void* values, uint32_t count, uint32_t valueSize, bool swap)
+	{
+		ArrayData* data = (ArrayData*)array->private_data;
+		ArrowArray* child = new ArrowArray();
+		ArrayData* childData = initArray(child, count, 0, 2);
+		childData->buffers[1] = exportBuffer(childData, values, count, valueSize, swap);
+		data->children.push_back(child);
+		array->n_children = 1;
+		array->children = data->children.data();
+	}
+
+	// Releasing a parent releases its children, as required by the interface
+	static void releaseSchema(ArrowSchema* schema)
+	{
+		SchemaData* data = (SchemaData*)schema->private_data;
+		for (ArrowSchema* child : data->children)
+		{
+			if(child->release)
+			{
+				child->release(child);
+			}
+			delete child;
+		}
+		delete data;
+		schema->release = nullptr;
+	}
+
+	static void releaseArray(ArrowArray* array)
+	{
+		ArrayData* data = (ArrayData*)array->private_data;
+		for (ArrowArray* child : data->children)
+		{
+			if(child->release)
+			{
+				child->release(child);
+			}
+			delete child;
+		}
+		delete data;
+		array->release = nullptr;
+	}
+};
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Bitmaps are byte arrays where bit i is stored in byte i / 8 at bit position i % 8
+// (the layout of Arrow validity bitmaps). All kernels process 64 bits per word and
+// use 128/256 bit vectors where available. Bitmaps are padded to a multiple of
+// 8 bytes (see getSize()); pointers need no particular alignment.
+struct BTableBitmap
+{
+	static constexpr uint64_t getSize(uint64_t numBits)
+	{
+		return ((numBits + 63) / 64) * 8;
+	}
+
+	static bool get(const uint8_t* bitmap, uint32_t index)
+	{
+		return (bitmap[index >> 3] >> (index & 7)) & 1;
+	}
+
+	static void set(uint8_t* bitmap, uint32_t index, bool value)
+	{
+		uint8_t mask = (uint8_t)(1 << (index & 7));
+		bitmap[index >> 3] = value ? (bitmap[index >> 3] | mask) : (bitmap[index >> 3] & ~mask);
+	}
+
+	static void fill(uint8_t* bitmap, uint32_t numBits, bool value)
+	{
+		memset(bitmap, value ? 0xFF : 0x00, getSize(numBits));
+	}
+
+	// Sets bits [begin, end), whole bytes with memset
+	static void fillRange(uint8_t* bitmap, uint32_t begin, uint32_t end, bool value)
+	{
+		while(begin < end && (begin & 7))
+		{
+			set(bitmap, begin++, value);
+		}
+		while(end > begin && (end & 7))
+		{
+			set(bitmap, --end, value);
+		}
+		if(begin < end)
+		{
+			memset(bitmap + (begin >> 3), value ? 0xFF : 0x00, (end - begin) >> 3);
+		}
+	}
+
+	// Loads 64 bits starting at bit 64 * wordIndex
+	static uint64_t loadWord(const uint8_t* bitmap, uint32_t wordIndex)
+	{
+		uint64_t word;
+		memcpy(&word, bitmap + wordIndex * 8, 8);
+		if(!isLittleEndianCpu())
+		{
+			word = byteswap64(word);
+		}
+		return word;
+	}
+
+	// Stores 64 bits starting at bit 64 * wordIndex
+	static void storeWord(uint8_t* bitmap, uint32_t wordIndex, uint64_t word)
+	{
+		if(!isLittleEndianCpu())
+		{
+			word = byteswap64(word);
+		}
+		memcpy(bitmap + wordIndex * 8, &word, 8);
+	}
+
+	// Mask for the valid bits of the word at wordIndex in a bitmap of numBits
+	static uint64_t wordMask(uint32_t wordIndex, uint32_t numBits)
+	{
+		uint32_t remaining = numBits - wordIndex * 64;
+		return remaining >= 64 ? ~(uint64_t)0 : (((uint64_t)1 << remaining) - 1);
+	}
+
+	static int popcount64(uint64_t x)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_popcountll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+		return (int)__popcnt64(x);
+#else
+		x = x - ((x >> 1) & 0x5555555555555555ull);
+		x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+		x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+		return (int)((x * 0x0101010101010101ull) >> 56);
+#endif
+	}
+
+	// x must not be zero
+	static int countTrailingZeros64(uint64_t x)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_ctzll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+		unsigned long index;
+		_BitScanForward64(&index, x);
+		return (int)index;
+#else
+		int n = 0;
+		while((x & 1) == 0)
+		{
+			x >>= 1;
+			n++;
+		}
+		return n;
+#endif
+	}
+
+	// Number of set bits among the first numBits
+	static uint32_t count(const uint8_t* bitmap, uint32_t numBits)
+	{
+		uint32_t numWords = (numBits + 63) / 64;
+		uint32_t total = 0;
+		for (uint32_t w = 0; w < numWords; w++)
+		{
+			total += popcount64(loadWord(bitmap, w) & wordMask(w, numBits));
+		}
+		return total;
+	}
+
+	// dst = a & b, dst may alias a or b
+	static void bitwiseAnd(uint8_t* dst, const uint8_t* a, const uint8_t* b, uint32_t numBits)
+	{
+		combine(dst, a, b, numBits, [](uint64_t x, uint64_t y) { return x & y; }, Op::And);
+	}
+
+	// dst = a | b, dst may alias a or b
+	static void bitwiseOr(uint8_t* dst, const uint8_t* a, const uint8_t* b, uint32_t numBits)
+	{
+		combine(dst, a, b, numBits, [](uint64_t x, uint64_t y) { return x | y; }, Op::Or);
+	}
+
+	// dst = a & ~b, dst may alias a or b
+	static void bitwiseAndNot(uint8_t* dst, const uint8_t* a, const uint8_t* b, uint32_t numBits)
+	{
+		combine(dst, a, b, numBits, [](uint64_t x, uint64_t y) { return x & ~y; }, Op::AndNot);
+	}
+
+private:
+	enum class Op
+	{
+		And,
+		Or,
+		AndNot
+	};
+
+	static bool isLittleEndianCpu()
+	{
+		static const uint32_t i = 1;
+		return *(const uint8_t*)&i == 1;
+	}
+
+	static uint64_t byteswap64(uint64_t x)
+	{
+		x = ((x & 0x00000000FFFFFFFFull) << 32) | ((x & 0xFFFFFFFF00000000ull) >> 32);
+		x = ((x & 0x0000FFFF0000FFFFull) << 16) | ((x & 0xFFFF0000FFFF0000ull) >> 16);
+		return ((x & 0x00FF00FF00FF00FFull) << 8) | ((x & 0xFF00FF00FF00FF00ull) >> 8);
+	}
+
+	// Bitwise operations are byte order independent, so words are processed as stored
+	template <typename F>
+	static void combine(uint8_t* dst, const uint8_t* a, const uint8_t* b, uint32_t numBits, F scalar, Op op)
+	{
+		uint64_t numBytes = getSize(numBits);
+		uint32_t i = 0;
+#if defined(__AVX2__)
+		for (; i + 32 <= numBytes; i += 32)
+		{
+			__m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+			__m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+			__m256i r = op == Op::And ? _mm256_and_si256(x, y) : op == Op::Or ? _mm256_or_si256(x, y) : _mm256_andnot_si256(y, x);
+			_mm256_storeu_si256((__m256i*)(dst + i), r);
+		}
+#elif defined(__SSE2__) || defined(_M_X64)
+		for (; i + 16 <= numBytes; i += 16)
+		{
+			__m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+			__m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+			__m128i r = op == Op::And ? _mm_and_si128(x, y) : op == Op::Or ? _mm_or_si128(x, y) : _mm_andnot_si128(y, x);
+			_mm_storeu_si128((__m128i*)(dst + i), r);
+		}
+#else
+		(void)op;
+#endif
+		for (; i < numBytes; i += 8)
+		{
+			uint64_t x, y;
+			memcpy(&x, a + i, 8);
+			memcpy(&y, b + i, 8);
+			uint64_t r = scalar(x, y);
+			memcpy(dst + i, &r, 8);
+		}
+	}
+};
@@ -1,16 +1,38 @@
 #pragma once
 
 #include <cinttypes>
+#include <algorithm>
 #include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <optional>
+#include <vector>
 
-template <typename T>
-class BTableGeneric
+#include "bitmap.h"
+#include "instrumentation.h"
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#elif defined(_MSC_VER) && !defined(__clang__)
+#include <xmmintrin.h>
+#endif
+
+// Instrumentation is a policy receiving hooks for lookups, reads, byteswaps and
+// timed operations (see instrumentation.h). The default policy does nothing.
+template <typename T, typename Instrumentation = BTableInstrumentation>
+class BTableGeneric : private Instrumentation
 {
 public:
 
 	static constexpr uint32_t magic[] = { 0x42, 0x54, 0x42, 0x4C };
 	static constexpr uint32_t field_list_offset = 16;
 	static constexpr uint32_t field_entry_size = 8;
+	static constexpr uint8_t field_type_mask = 0x3F; // FieldListEntry::dataType bits holding the DataType
+	static constexpr uint8_t field_flag_nullable = 0x80; // Column is followed by a validity bitmap
+	static constexpr uint8_t field_flag_list = 0x40; // Variable length list column, see getList()
+	static constexpr uint8_t options_alignment_shift = 4; // Header::options bits 4-7 hold log2 of the column alignment
+	static constexpr uint32_t max_column_alignment = 1 << 15; // Limited by the 4 option bits and the 16 bit dataOffset
+	static constexpr uint32_t max_data_offset = 0xFFFF; // Header::dataOffset is 16 bit, see getDataOffset()
 
 	static bool isLittleEndianCpu()
 	{
@@ -50,6 +72,61 @@ public:
 		return is_little_endian_cpu ? byteswap16(x) : x;
 	}
 
+	static uint64_t byteswap64(uint64_t x)
+	{
+		return ((uint64_t)byteswap32((uint32_t)x) << 32) | byteswap32((uint32_t)(x >> 32));
+	}
+
+	// Reads a value of type V stored in the given byte order
+	template <typename V>
+	static V loadValue(const void* ptr, bool swap)
+	{
+		V value;
+		memcpy(&value, ptr, sizeof(V));
+		if(swap)
+		{
+			value = swapValue(value);
+		}
+		return value;
+	}
+
+	template <typename V>
+	static void storeValue(void* ptr, V value, bool swap)
+	{
+		if(swap)
+		{
+			value = swapValue(value);
+		}
+		memcpy(ptr, &value, sizeof(V));
+	}
+
+	template <typename V>
+	static V swapValue(V value)
+	{
+		if constexpr (sizeof(V) == 2)
+		{
+			uint16_t x;
+			memcpy(&x, &value, 2);
+			x = byteswap16(x);
+			memcpy(&value, &x, 2);
+		}
+		else if constexpr (sizeof(V) == 4)
+		{
+			uint32_t x;
+			memcpy(&x, &value, 4);
+			x = byteswap32(x);
+			memcpy(&value, &x, 4);
+		}
+		else if constexpr (sizeof(V) == 8)
+		{
+			uint64_t x;
+			memcpy(&x, &value, 8);
+			x = byteswap64(x);
+			memcpy(&value, &x, 8);
+		}
+		return value;
+	}
+
 	enum DataType
 	{
 		INT8 = 0,
@@ -58,7 +135,14 @@ public:
 		INT64,
 		FLOAT32,
 		FLOAT64,
-		STRING
+		STRING,
+		BOOL, // Bit-packed, see getValueBool()
+		FLOAT16, // IEEE 754 half precision, see getValueFloat16()
+		BFLOAT16, // Upper half of a FLOAT32, see getValueBFloat16()
+		UINT8,
+		UINT16,
+		UINT32,
+		UINT64
 	};
 
 	enum Endianness : uint8_t
@@ -78,6 +162,9 @@ public:
 		const char* name;
 		uint8_t arraySize;
 		enum DataType dataType;
+		bool nullable = false; // Adds a validity bitmap after the column
+		bool list = false; // Variable length list of dataType per entry, arraySize is ignored
+		uint32_t listCapacity = 0; // Total number of values over all lists of a list column
 	};
 
 	struct Header
@@ -110,11 +197,41 @@ public:
 		case FLOAT32: return 4;
 		case FLOAT64: return 8;
 		case STRING: return 4;
+		case BOOL: return 0;
+		case FLOAT16: return 2;
+		case BFLOAT16: return 2;
+		case UINT8: return 1;
+		case UINT16: return 2;
+		case UINT32: return 4;
+		case UINT64: return 8;
 		default: return 0;
 		}
 	}
 
-	static constexpr int getPadding(unsigned int block_size, unsigned int alignment)
+	static unsigned int getDatatypeBits(enum DataType dataType)
+	{
+		return dataType == BOOL ? 1 : getDatatypeSize(dataType) * 8;
+	}
+
+	// Bit-packed columns have no byte address per value, their entries are bit indices
+	static bool isBitPacked(enum DataType dataType)
+	{
+		return dataType == BOOL;
+	}
+
+	// Bytes of the values of a fixed size column. Bit-packed values use the layout of
+	// validity bitmaps, bit entry * arraySize + index holds element index of an entry
+	static uint64_t getValuesSize(enum DataType dataType, uint32_t arraySize, uint64_t numEntries)
+	{
+		uint64_t numValues = (arraySize == 0 ? 1 : arraySize) * numEntries;
+		if(isBitPacked(dataType))
+		{
+			return BTableBitmap::getSize(numValues);
+		}
+		return getDatatypeSize(dataType) * numValues;
+	}
+
+	static constexpr uint32_t getPadding(uint64_t block_size, uint32_t alignment)
 	{
 		return (alignment - block_size % alignment) % alignment;
 	}
@@ -138,21 +255,123 @@ public:
 
 	static uint32_t getBytesPerEntry(const FieldListEntry* fieldListEntry)
 	{
-		return getDatatypeSize((DataType)fieldListEntry->dataType) * (fieldListEntry->arraySize == 0 ? 1 : fieldListEntry->arraySize);
+		return getDatatypeSize(getFieldDataType(fieldListEntry)) * (fieldListEntry->arraySize == 0 ? 1 : fieldListEntry->arraySize);
+	}
+
+	static DataType getFieldDataType(const FieldListEntry* field)
+	{
+		return (DataType)(field->dataType & field_type_mask);
+	}
+
+	static bool isNullable(const FieldListEntry* field)
+	{
+		return (field->dataType & field_flag_nullable) != 0;
+	}
+
+	static bool isList(const FieldListEntry* field)
+	{
+		return (field->dataType & field_flag_list) != 0;
+	}
+
+	// Column alignment has to be a power of two up to max_column_alignment, 1 means packed columns
+	static bool isValidColumnAlignment(uint32_t columnAlignment)
+	{
+		return columnAlignment != 0 && columnAlignment <= max_column_alignment && (columnAlignment & (columnAlignment - 1)) == 0;
+	}
+
+	static uint8_t getAlignmentLog2(uint32_t columnAlignment)
+	{
+		uint8_t log2 = 0;
+		while((1u << log2) < columnAlignment)
+		{
+			log2++;
+		}
+		return log2;
+	}
+
+	// The data section starts 8 byte aligned, or aligned to the column alignment if larger
+	static uint32_t getDataOffset(uint32_t numFields, uint32_t columnAlignment = 1)
+	{
+		uint32_t fieldListEnd = field_list_offset + field_entry_size * numFields;
+		return fieldListEnd + getPadding(fieldListEnd, columnAlignment > 8 ? columnAlignment : 8);
+	}
+
+	// The layout helpers below compute in 64 bit, so column ends past 4 GiB do not wrap around.
+	// Start of a column following a column ending at previousEnd
+	static uint64_t getColumnOffset(uint64_t previousEnd, uint32_t columnAlignment = 1)
+	{
+		return previousEnd + getPadding(previousEnd, columnAlignment);
+	}
+
+	// A list column starts with its capacity and numEntries + 1 offsets (uint32, table byte order),
+	// followed by the flat values, 8 byte aligned or aligned to the column alignment if larger.
+	// List i holds values offsets[i] to offsets[i + 1]
+	static uint64_t getListValuesOffset(uint64_t columnOffset, uint64_t numEntries, uint32_t columnAlignment = 1)
+	{
+		uint64_t offsetsEnd = columnOffset + (numEntries + 2) * 4;
+		return offsetsEnd + getPadding(offsetsEnd, columnAlignment > 8 ? columnAlignment : 8);
+	}
+
+	// Offset of the first byte after the values of a column from start of data section
+	static uint64_t getValuesEnd(uint64_t columnOffset, const FieldData* field, uint64_t numEntries, uint32_t columnAlignment = 1)
+	{
+		if(field->list)
+		{
+			return getListValuesOffset(columnOffset, numEntries, columnAlignment) + (uint64_t)getDatatypeSize(field->dataType) * field->listCapacity;
+		}
+		return columnOffset + getValuesSize(field->dataType, field->arraySize, numEntries);
+	}
+
+	// Offset of a column's validity bitmap from start of data section. Bitmaps start 8 byte aligned
+	static uint64_t getValidityOffset(uint64_t valuesEnd)
+	{
+		return valuesEnd + getPadding(valuesEnd, 8);
+	}
+
+	// Offset of the first byte after a column (values and validity bitmap) from start of data section
+	static uint64_t getColumnEnd(uint64_t valuesEnd, bool nullable, uint64_t numEntries)
+	{
+		if(!nullable)
+		{
+			return valuesEnd;
+		}
+		return getValidityOffset(valuesEnd) + BTableBitmap::getSize(numEntries);
 	}
 
-	static uint32_t calculateBufferSize(const FieldData* fields, uint32_t numFields, uint32_t numEntries)
+	// With a column alignment > 1 the size is rounded up to a multiple of the alignment.
+	// Returns 0 if the alignment is invalid, the data offset does not fit Header::dataOffset
+	// or a column end or the size does not fit 32 bit
+	static uint32_t calculateBufferSize(const FieldData* fields, uint32_t numFields, uint32_t numEntries, uint32_t columnAlignment = 1)
 	{
+		if(!isValidColumnAlignment(columnAlignment))
+		{
+			return 0;
+		}
 		if(!fields)
 		{
 			return 16;
 		}
-		uint32_t bytesPerEntry = 0;
-		for (int i = 0; i < numFields; i++)
+		if(getDataOffset(numFields, columnAlignment) > max_data_offset)
+		{
+			return 0;
+		}
+		uint64_t offset = 0;
+		for (uint32_t i = 0; i < numFields; i++)
 		{
-			bytesPerEntry += getBytesPerEntry(&fields[i]);
+			offset = getColumnOffset(offset, columnAlignment);
+			offset = getColumnEnd(getValuesEnd(offset, &fields[i], numEntries, columnAlignment), fields[i].nullable, numEntries);
+			if(offset > UINT32_MAX)
+			{
+				return 0;
+			}
+		}
+		uint64_t size = offset + getDataOffset(numFields, columnAlignment);
+		size += getPadding(size, columnAlignment);
+		if(size > UINT32_MAX)
+		{
+			return 0;
 		}
-		return bytesPerEntry * numEntries + 16 + 8 * numFields;
+		return (uint32_t)size;
 	}
 
 	BTableGeneric(T buffer, uint32_t size) : bufferPtr(buffer), m_size(size)
@@ -160,8 +379,25 @@ public:
 		
 	}
 
-	void init(const FieldData* fields, uint16_t numFields, uint32_t numEntries)
+	// Every column start is aligned to columnAlignment relative to the buffer start.
+	// Multi-byte values are stored in dataEndianness. Returns false without writing anything if
+	// calculateBufferSize() returns 0 for the layout or more than the buffer size, or a list
+	// column has a bit-packed type
+	bool init(const FieldData* fields, uint16_t numFields, uint32_t numEntries, uint32_t columnAlignment = 1, enum Endianness dataEndianness = Big)
 	{
+		uint32_t size = calculateBufferSize(fields, numFields, numEntries, columnAlignment);
+		if(size == 0 || size > m_size)
+		{
+			return false;
+		}
+		for (int i = 0; i < numFields; i++)
+		{
+			if(fields[i].list && isBitPacked(fields[i].dataType))
+			{
+				return false;
+			}
+		}
+
 		Header* header = getHeader();
 		header->magic[0] = magic[0];
 		header->magic[1] = magic[1];
@@ -169,32 +405,76 @@ public:
 		header->magic[3] = magic[3];
 		header->numEntries = cpu_to_be32(numEntries);
 		header->numFields = cpu_to_be16(numFields);
-		header->options = 0;
+		header->options = getAlignmentLog2(columnAlignment) << options_alignment_shift;
+		if(dataEndianness == Little)
+		{
+			header->options |= 1 << Options::Endianness;
+		}
 		header->fieldNameLength = 0; // String field names not implemented
 		header->userData[0] = 0;
 		header->userData[1] = 0;
 
-		uint32_t offset = 0;
+		uint64_t offset = 0;
 		FieldListEntry* fieldList = getFieldList();
 		for (int i = 0; i < numFields; i++)
 		{
-			fieldList[i].offset = cpu_to_be32(offset);
+			offset = getColumnOffset(offset, columnAlignment);
+			fieldList[i].offset = cpu_to_be32((uint32_t)offset);
 			fieldList[i].name = cpu_to_be16(hash(fields[i].name)); // Hash
-			fieldList[i].dataType = fields[i].dataType;
-			fieldList[i].arraySize = fields[i].arraySize;
+			fieldList[i].dataType = fields[i].dataType | (fields[i].nullable ? field_flag_nullable : 0) | (fields[i].list ? field_flag_list : 0);
+			fieldList[i].arraySize = fields[i].list ? 1 : fields[i].arraySize;
 			if(fieldList[i].arraySize == 0)
 			{
 				fieldList[i].arraySize = 1;
 			}
 
-			offset += getDatatypeSize(fields[i].dataType) * fields[i].arraySize * numEntries;
+			offset = getColumnEnd(getValuesEnd(offset, &fields[i], numEntries, columnAlignment), fields[i].nullable, numEntries);
 		}
 
-		unsigned int bytesWritten = field_list_offset + sizeof(FieldListEntry) * numFields;
-		header->dataOffset = cpu_to_be16(bytesWritten + getPadding(bytesWritten, 8));
+		header->dataOffset = cpu_to_be16(getDataOffset(numFields, columnAlignment));
+
+		for (int i = 0; i < numFields; i++)
+		{
+			// All lists start out empty
+			if(fields[i].list)
+			{
+				uint32_t* listHeader = (uint32_t*)getEntries(&fieldList[i]);
+				memset(listHeader, 0, (numEntries + 2) * 4);
+				storeTableValue<uint32_t>(listHeader, fields[i].listCapacity, needsByteswap());
+			}
+			// Every value of a nullable column starts out as null
+			if(isNullable(&fieldList[i]))
+			{
+				BTableBitmap::fill(getValidityBitmap(&fieldList[i]), numEntries, false);
+			}
+		}
+		return true;
 	}
 
 	bool validate() const
+	{
+		if constexpr (Instrumentation::enabled)
+		{
+			this->beginOperation(Instrumentation::Validate);
+			bool valid = validateLayout();
+			this->endOperation(Instrumentation::Validate, valid ? getNumEntries() : 0, m_size);
+			return valid;
+		}
+		return validateLayout();
+	}
+
+	const Instrumentation& getInstrumentation() const
+	{
+		return *this;
+	}
+
+	Instrumentation& getInstrumentation()
+	{
+		return *this;
+	}
+
+private:
+	bool validateLayout() const
 	{
 		const Header* header = getHeader();
 
@@ -218,16 +498,45 @@ public:
 		}
 
 		uint32_t bytesPerEntry = 0;
+		uint32_t numEntries = getNumEntries();
+		uint32_t dataOffset = loadBe16(header->dataOffset);
+		uint32_t columnAlignment = getColumnAlignment();
+		if(!isValidColumnAlignment(columnAlignment) || dataOffset % columnAlignment != 0)
+		{
+			return false;
+		}
+		// The data section must not overlap the header and field list
+		if(dataOffset < field_list_offset + field_entry_size * numFields)
+		{
+			return false;
+		}
+
 		const FieldListEntry* fieldList = getFieldList();
 		for (size_t i = 0; i < numFields; i++)
 		{
-			bytesPerEntry += getBytesPerEntry(&fieldList[i]);
-			if(!(be32_to_cpu(fieldList[i].offset) < m_size))
+			const FieldListEntry* field = &fieldList[i];
+			uint32_t offset = loadBe32(field->offset);
+			if(!(offset < m_size) || offset % columnAlignment != 0)
+			{
+				return false;
+			}
+			if(isList(field))
+			{
+				if(!validateList(field, dataOffset, offset, numEntries))
+				{
+					return false;
+				}
+			}
+			else
+			{
+				bytesPerEntry += getBytesPerEntry(field);
+			}
+			if(dataOffset + getColumnEnd(field, numEntries) > m_size)
 			{
 				return false;
 			}
 		}
-		if(m_size < bytesPerEntry * getNumEntries() + field_list_offset + field_entry_size * numFields)
+		if(m_size < (uint64_t)bytesPerEntry * numEntries + field_list_offset + field_entry_size * numFields)
 		{
 			return false;
 		}
@@ -235,6 +544,44 @@ public:
 		return true;
 	}
 
+	// End of a column for numEntries entries, which may differ from getNumEntries() while
+	// validating. Lists have to pass validateList() first
+	uint64_t getColumnEnd(const FieldListEntry* field, uint64_t numEntries) const
+	{
+		return getColumnEnd(getValuesEnd(field, numEntries), isNullable(field), numEntries);
+	}
+
+	bool validateList(const FieldListEntry* field, uint32_t dataOffset, uint32_t offset, uint32_t numEntries) const
+	{
+		if((uint64_t)dataOffset + offset + ((uint64_t)numEntries + 2) * 4 > m_size)
+		{
+			return false;
+		}
+		if(isBitPacked(getFieldDataType(field)))
+		{
+			return false;
+		}
+		const unsigned char* listHeader = bufferPtr + dataOffset + offset;
+		bool swap = needsByteswap();
+		uint64_t capacity = loadTableValue<uint32_t>(listHeader, swap);
+		if(capacity * getDatatypeSize(getFieldDataType(field)) > m_size)
+		{
+			return false;
+		}
+		uint32_t previous = 0;
+		for (uint32_t i = 0; i <= numEntries; i++)
+		{
+			uint32_t listOffset = loadTableValue<uint32_t>(listHeader + 4 + i * 4, swap);
+			if(listOffset < previous || listOffset > capacity)
+			{
+				return false;
+			}
+			previous = listOffset;
+		}
+		return true;
+	}
+
+public:
 	Header* getHeader()
 	{
 		return reinterpret_cast<Header*>(bufferPtr);
@@ -245,6 +592,11 @@ public:
 		return reinterpret_cast<const Header*>(bufferPtr);
 	}
 
+	uint32_t getBufferSize() const
+	{
+		return m_size;
+	}
+
 	FieldListEntry* getFieldList()
 	{
 		return reinterpret_cast<FieldListEntry*>(bufferPtr + field_list_offset);
@@ -257,17 +609,44 @@ public:
 
 	int8_t* getDataSection()
 	{
-		return bufferPtr + be16_to_cpu(getHeader()->dataOffset);
+		return bufferPtr + loadBe16(getHeader()->dataOffset);
 	}
 
 	uint32_t getNumEntries() const
 	{
-		return be32_to_cpu(getHeader()->numEntries);
+		return loadBe32(getHeader()->numEntries);
 	}
 
 	uint16_t getNumFields() const
 	{
-		return be16_to_cpu(getHeader()->numFields);
+		return loadBe16(getHeader()->numFields);
+	}
+
+	// True if multi-byte values have to be byteswapped between table and CPU byte order
+	bool needsByteswap() const
+	{
+		return isDataLittleEndian() != is_little_endian_cpu;
+	}
+
+	// Every column starts at a multiple of this from the buffer start, 1 for packed tables.
+	// At most max_column_alignment (32 KiB): enough for cache lines, SIMD and 4 KiB pages,
+	// but columns are not guaranteed to start on huge page (2 MiB) boundaries
+	uint32_t getColumnAlignment() const
+	{
+		return 1u << (getHeader()->options >> options_alignment_shift);
+	}
+
+	// If true, every column pointer is aligned to getColumnAlignment(), e.g. for aligned SIMD loads.
+	// This says nothing about huge page boundaries, see getColumnAlignment()
+	bool isBufferAligned() const
+	{
+		return (uintptr_t)bufferPtr % getColumnAlignment() == 0;
+	}
+
+	// Byte order of multi-byte values in the data section
+	bool isDataLittleEndian() const
+	{
+		return (getHeader()->options & (1 << Options::Endianness)) != 0;
 	}
 
 	void setUserData(uint8_t high, uint8_t low)
@@ -318,6 +697,10 @@ public:
 
 	uint32_t getFieldIndex(const char* fieldName) const
 	{
+		if constexpr (Instrumentation::enabled)
+		{
+			this->onFieldLookup();
+		}
 		uint16_t hash = cpu_to_be16(this->hash(fieldName));
 		const FieldListEntry* fieldList = getFieldList();
 		uint32_t numFields = getNumFields();
@@ -331,81 +714,1109 @@ public:
 		return (uint32_t)-1;
 	}
 
+	uint32_t getFieldIndex(const FieldListEntry* field) const
+	{
+		return (uint32_t)(field - getFieldList());
+	}
+
 	// --- Generic getters ---
 
+	// For bit-packed columns this is the byte holding the first bit of the entry
 	const void* getValuePtr(const FieldListEntry* field, uint32_t entry) const
 	{
-		return bufferPtr + be16_to_cpu(getHeader()->dataOffset) + be32_to_cpu(field->offset) + getDatatypeSize((DataType)field->dataType) * field->arraySize * entry;
+		return bufferPtr + loadBe16(getHeader()->dataOffset) + loadBe32(field->offset) + (size_t)getDatatypeBits(getFieldDataType(field)) * field->arraySize * entry / 8;
 	}
 
 	void* getEntries(const FieldListEntry* field)
 	{
 		// error check if field is an array?
-		return bufferPtr + be16_to_cpu(getHeader()->dataOffset) + be32_to_cpu(field->offset);
+		return bufferPtr + loadBe16(getHeader()->dataOffset) + loadBe32(field->offset);
 	}
 
-	void* getEntries(const FieldListEntry* field) const
+	const void* getEntries(const FieldListEntry* field) const
 	{
 		// error check if field is an array?
-		return bufferPtr + be16_to_cpu(getHeader()->dataOffset) + be32_to_cpu(field->offset);
+		return bufferPtr + loadBe16(getHeader()->dataOffset) + loadBe32(field->offset);
 	}
 
-/* -------------------------- Type specific setters ------------------------- */
-
-	// sets only a single value
-	void setValueInt8(const FieldListEntry* field, uint32_t entry, uint8_t value)
+	// Calls callback(const void* value, uint32_t entry) for every entry of a column.
+	// Returns false for list or bit-packed columns, use countTrue() for BOOL columns
+	template <typename F>
+	bool forEachEntry(const FieldListEntry* field, F&& callback) const
 	{
-		// check if arraySize is != 1 and throw error
-		*(uint8_t*)getValuePtr(field, entry) = value;
+		if(isList(field) || isBitPacked(getFieldDataType(field)))
+		{
+			return false;
+		}
+		uint32_t numEntries = getNumEntries();
+		uint32_t stride = getBytesPerEntry(field);
+		const unsigned char* value = (const unsigned char*)getValuePtr(field, 0);
+		if constexpr (Instrumentation::enabled)
+		{
+			this->beginOperation(Instrumentation::Scan);
+		}
+		for (uint32_t i = 0; i < numEntries; i++, value += stride)
+		{
+			callback((const void*)value, i);
+		}
+		if constexpr (Instrumentation::enabled)
+		{
+			this->endOperation(Instrumentation::Scan, numEntries, (uint64_t)stride * numEntries);
+		}
+		recordRead(field, stride * numEntries);
+		return true;
 	}
 
-	// sets the array of an entry
-	void setArrayInt8(const FieldListEntry* field, uint32_t entry, int8_t* srcArray, uint32_t n)
+/* ------------------------------ Validity bitmaps ----------------------------- */
+
+	// Returns nullptr if the column is not nullable
+	const uint8_t* getValidityBitmap(const FieldListEntry* field) const
 	{
-		// Add error handling of dest size < src size
-		void* startPtr = getValuePtr(field, entry);
-		if(field->arraySize > n)
+		if(!isNullable(field))
 		{
-			n = field->arraySize;
+			return nullptr;
 		}
-		memcpy(startPtr, srcArray, n);
+		return bufferPtr + loadBe16(getHeader()->dataOffset) + getValidityOffset(getValuesEnd(field));
 	}
 
-	// sets every entry in a column. only for single values, not arrays
-	void setEntries(const FieldListEntry* field, uint32_t startEntry, int8_t* srcArray, uint32_t n)
+	uint8_t* getValidityBitmap(const FieldListEntry* field)
 	{
-		// check if arraySize is != 1 and throw error
-		void* startPtr = (int8_t*)getEntries(field) + startEntry;
-		uint32_t dstSize = getNumEntries() - startEntry;
-		if(dstSize > n)
+		return (uint8_t*)((const BTableGeneric*)this)->getValidityBitmap(field);
+	}
+
+	// Values of columns that are not nullable are always valid
+	bool isValid(const FieldListEntry* field, uint32_t entry) const
+	{
+		const uint8_t* validity = getValidityBitmap(field);
+		return !validity || BTableBitmap::get(validity, entry);
+	}
+
+	void setValid(const FieldListEntry* field, uint32_t entry, bool valid)
+	{
+		uint8_t* validity = getValidityBitmap(field);
+		if(validity)
 		{
-			n = dstSize;
+			BTableBitmap::set(validity, entry, valid);
 		}
-		memcpy(startPtr, srcArray, n);
 	}
 
-/* -------------------------- Type specific getters ------------------------- */
+	void setNull(const FieldListEntry* field, uint32_t entry)
+	{
+		setValid(field, entry, false);
+	}
 
-	int8_t getValueInt8(const FieldListEntry* field, uint32_t entry) const
+	// Number of valid entries, restricted to the set bits of selection if given
+	uint32_t countValid(const FieldListEntry* field, const uint8_t* selection = nullptr) const
 	{
-		return *(uint8_t*)getValuePtr(field, entry);
+		uint32_t numEntries = getNumEntries();
+		const uint8_t* validity = getValidityBitmap(field);
+		if(!validity)
+		{
+			return selection ? BTableBitmap::count(selection, numEntries) : numEntries;
+		}
+		if(!selection)
+		{
+			return BTableBitmap::count(validity, numEntries);
+		}
+		uint32_t total = 0;
+		for (uint32_t w = 0; w < (numEntries + 63) / 64; w++)
+		{
+			total += BTableBitmap::popcount64(BTableBitmap::loadWord(validity, w) & BTableBitmap::loadWord(selection, w) & BTableBitmap::wordMask(w, numEntries));
+		}
+		return total;
 	}
 
-	int8_t getValueInt8Array(const FieldListEntry* field, uint32_t entry, uint16_t index) const
+	// dst = validity & selection. dst needs BTableBitmap::getSize(getNumEntries()) bytes
+	void selectValid(const FieldListEntry* field, const uint8_t* selection, uint8_t* dst) const
 	{
-		// TODO: add error checking
-		return ((uint8_t*)getValuePtr(field, entry))[index];
+		uint32_t numEntries = getNumEntries();
+		const uint8_t* validity = getValidityBitmap(field);
+		if(!validity)
+		{
+			memcpy(dst, selection, BTableBitmap::getSize(numEntries));
+			return;
+		}
+		BTableBitmap::bitwiseAnd(dst, validity, selection, numEntries);
 	}
 
-private:
-	void* getValuePtr(const FieldListEntry* field, uint32_t entry)
+	// Sums the valid values of a column, restricted to the set bits of selection if given.
+	// count receives the number of summed values. Array, list and bit-packed columns sum to 0
+	// with count 0, use countTrue() for BOOL columns
+	template <typename V, typename Acc = V>
+	Acc sumValues(const FieldListEntry* field, const uint8_t* selection = nullptr, uint32_t* count = nullptr) const
 	{
-		return bufferPtr + be16_to_cpu(getHeader()->dataOffset) + be32_to_cpu(field->offset) + getDatatypeSize((DataType)field->dataType) * field->arraySize * entry;
+		if(field->arraySize > 1 || isList(field) || isBitPacked(getFieldDataType(field)))
+		{
+			if(count)
+			{
+				*count = 0;
+			}
+			return 0;
+		}
+		uint32_t numEntries = getNumEntries();
+		uint32_t stride = getBytesPerEntry(field);
+		const uint8_t* validity = getValidityBitmap(field);
+		const unsigned char* values = (const unsigned char*)getValuePtr(field, 0);
+		bool swap = needsByteswap();
+
+		if constexpr (Instrumentation::enabled)
+		{
+			this->beginOperation(Instrumentation::Scan);
+		}
+		Acc total = 0;
+		uint32_t summed = 0;
+		for (uint32_t w = 0; w < (numEntries + 63) / 64; w++)
+		{
+			uint64_t mask = BTableBitmap::wordMask(w, numEntries);
+			if(validity)
+			{
+				mask &= BTableBitmap::loadWord(validity, w);
+			}
+			if(selection)
+			{
+				mask &= BTableBitmap::loadWord(selection, w);
+			}
+
+			const unsigned char* base = values + (size_t)w * 64 * stride;
+			if(mask == ~(uint64_t)0)
+			{
+				// Dense word, straight loop the compiler can vectorize
+				for (uint32_t j = 0; j < 64; j++)
+				{
+					total += (Acc)loadTableValue<V>(base + j * stride, swap);
+				}
+				summed += 64;
+				continue;
+			}
+			summed += BTableBitmap::popcount64(mask);
+			while(mask)
+			{
+				total += (Acc)loadTableValue<V>(base + BTableBitmap::countTrailingZeros64(mask) * stride, swap);
+				mask &= mask - 1;
+			}
+		}
+		if constexpr (Instrumentation::enabled)
+		{
+			this->endOperation(Instrumentation::Scan, numEntries, (uint64_t)stride * numEntries);
+		}
+		recordRead(field, stride * numEntries);
+
+		if(count)
+		{
+			*count = summed;
+		}
+		return total;
 	}
 
-	T bufferPtr;
-	uint32_t m_size;
-};
+/* -------------------------------- List columns ------------------------------- */
 
-typedef BTableGeneric<unsigned char*> BTable;
-typedef BTableGeneric<const unsigned char*> BTableReadOnly;
+	// Zero-copy typed view of a list. Elements are in the table byte order
+	template <typename V>
+	struct ListView
+	{
+		const V* data;
+		uint32_t size;
+
+		const V* begin() const { return data; }
+		const V* end() const { return data + size; }
+		const V& operator[](uint32_t i) const { return data[i]; }
+	};
+
+	uint32_t getListCapacity(const FieldListEntry* field) const
+	{
+		return loadTableValue<uint32_t>(getEntries(field), needsByteswap());
+	}
+
+	// Start of list entry in the flat values, entry may be getNumEntries() for the total size
+	uint32_t getListOffset(const FieldListEntry* field, uint32_t entry) const
+	{
+		return loadTableValue<uint32_t>((const unsigned char*)getEntries(field) + 4 + entry * 4, needsByteswap());
+	}
+
+	uint32_t getListSize(const FieldListEntry* field, uint32_t entry) const
+	{
+		return getListOffset(field, entry + 1) - getListOffset(field, entry);
+	}
+
+	// Flat values of all lists, count receives the number of values in use
+	const void* getListValues(const FieldListEntry* field, uint32_t* count = nullptr) const
+	{
+		if(count)
+		{
+			*count = getListOffset(field, getNumEntries());
+		}
+		return bufferPtr + loadBe16(getHeader()->dataOffset) + getListValuesOffset(loadBe32(field->offset), getNumEntries(), getColumnAlignment());
+	}
+
+	// Pointer to the first value of a list entry, size receives the number of values
+	const void* getList(const FieldListEntry* field, uint32_t entry, uint32_t* size) const
+	{
+		uint32_t start = getListOffset(field, entry);
+		*size = getListOffset(field, entry + 1) - start;
+		recordRead(field, *size * getDatatypeSize(getFieldDataType(field)));
+		return (const unsigned char*)getListValues(field) + start * getDatatypeSize(getFieldDataType(field));
+	}
+
+	// Typed values of a list entry. Multi-byte values are only viewable in native byte order:
+	// if the table needs a byteswap, data is nullptr and size 0, use getList() and loadValue()
+	template <typename V>
+	ListView<V> getListView(const FieldListEntry* field, uint32_t entry) const
+	{
+		ListView<V> view;
+		if(sizeof(V) > 1 && needsByteswap())
+		{
+			view.data = nullptr;
+			view.size = 0;
+			return view;
+		}
+		view.data = (const V*)getList(field, entry, &view.size);
+		return view;
+	}
+
+	// Appends the list of an entry. Entries have to be written in order starting at 0 and
+	// every entry has to be written (n = 0 for empty lists). values are in the table byte order.
+	// Returns false if the capacity of the column is exceeded or entry is not the next entry
+	// to append. While every list written so far is empty, skipped entries read as empty lists
+	bool setList(const FieldListEntry* field, uint32_t entry, const void* values, uint32_t n)
+	{
+		uint32_t start;
+		if(!getListAppendStart(field, entry, n, &start))
+		{
+			return false;
+		}
+		uint32_t valueSize = getDatatypeSize(getFieldDataType(field));
+		if(n > 0)
+		{
+			memcpy((unsigned char*)getListValues(field) + start * valueSize, values, n * valueSize);
+		}
+		storeListEnd(field, entry, start + n, needsByteswap());
+		setValid(field, entry, true);
+		return true;
+	}
+
+	// Like setList(), converting native values to the table byte order
+	template <typename V>
+	bool setListValues(const FieldListEntry* field, uint32_t entry, const V* values, uint32_t n)
+	{
+		if(!needsByteswap() || sizeof(V) == 1)
+		{
+			return setList(field, entry, values, n);
+		}
+		uint32_t start;
+		if(!getListAppendStart(field, entry, n, &start))
+		{
+			return false;
+		}
+		unsigned char* dst = (unsigned char*)getListValues(field) + start * sizeof(V);
+		for (uint32_t i = 0; i < n; i++)
+		{
+			storeTableValue<V>(dst + i * sizeof(V), values[i], true);
+		}
+		storeListEnd(field, entry, start + n, true);
+		setValid(field, entry, true);
+		return true;
+	}
+
+	// Sums all values of all lists in one pass over the contiguous flat values
+	template <typename V, typename Acc = V>
+	Acc sumListValues(const FieldListEntry* field) const
+	{
+		uint32_t count;
+		const unsigned char* values = (const unsigned char*)getListValues(field, &count);
+		bool swap = needsByteswap();
+		if constexpr (Instrumentation::enabled)
+		{
+			this->beginOperation(Instrumentation::Scan);
+		}
+		Acc total = 0;
+		if(!swap)
+		{
+			const V* typed = (const V*)values;
+			for (uint32_t i = 0; i < count; i++)
+			{
+				total += (Acc)typed[i];
+			}
+		}
+		else
+		{
+			for (uint32_t i = 0; i < count; i++)
+			{
+				total += (Acc)loadTableValue<V>(values + i * sizeof(V), true);
+			}
+		}
+		if constexpr (Instrumentation::enabled)
+		{
+			this->endOperation(Instrumentation::Scan, count, (uint64_t)count * sizeof(V));
+		}
+		recordRead(field, count * sizeof(V));
+		return total;
+	}
+
+/* ----------------------------- Generic accessors ----------------------------- */
+
+	// Reads element index of an entry, converting from the table byte order.
+	// Bit-packed columns are read with getValueBool()
+	template <typename V>
+	V getValue(const FieldListEntry* field, uint32_t entry, uint32_t index = 0) const
+	{
+		if(isBitPacked(getFieldDataType(field)))
+		{
+			return (V)getValueBool(field, entry, index);
+		}
+		recordRead(field, sizeof(V));
+		return loadTableValue<V>((const unsigned char*)getValuePtr(field, entry) + index * sizeof(V), needsByteswap());
+	}
+
+	// Returns an empty optional if the entry is null
+	template <typename V>
+	std::optional<V> getNullableValue(const FieldListEntry* field, uint32_t entry, uint32_t index = 0) const
+	{
+		if(!isValid(field, entry))
+		{
+			return std::nullopt;
+		}
+		return getValue<V>(field, entry, index);
+	}
+
+	// Writes element index of an entry and marks the entry valid.
+	// Bit-packed columns are written with setValueBool(), any non-zero value is true
+	template <typename V>
+	void setValue(const FieldListEntry* field, uint32_t entry, V value, uint32_t index = 0)
+	{
+		if(isBitPacked(getFieldDataType(field)))
+		{
+			setValueBool(field, entry, value != (V)0, index);
+			return;
+		}
+		storeTableValue<V>((unsigned char*)getValuePtr(field, entry) + index * sizeof(V), value, needsByteswap());
+		setValid(field, entry, true);
+	}
+
+/* ------------------------------- Compact types ------------------------------- */
+
+	bool getValueBool(const FieldListEntry* field, uint32_t entry, uint32_t index = 0) const
+	{
+		recordRead(field, 1);
+		return BTableBitmap::get((const uint8_t*)getEntries(field), entry * field->arraySize + index);
+	}
+
+	// Writes element index of an entry and marks the entry valid
+	void setValueBool(const FieldListEntry* field, uint32_t entry, bool value, uint32_t index = 0)
+	{
+		BTableBitmap::set((uint8_t*)getEntries(field), entry * field->arraySize + index, value);
+		setValid(field, entry, true);
+	}
+
+	// Number of true values over all elements of a BOOL column, nulls included
+	uint32_t countTrue(const FieldListEntry* field) const
+	{
+		return BTableBitmap::count((const uint8_t*)getEntries(field), getNumEntries() * field->arraySize);
+	}
+
+	float getValueFloat16(const FieldListEntry* field, uint32_t entry, uint32_t index = 0) const
+	{
+		return halfToFloat(getValue<uint16_t>(field, entry, index));
+	}
+
+	void setValueFloat16(const FieldListEntry* field, uint32_t entry, float value, uint32_t index = 0)
+	{
+		setValue<uint16_t>(field, entry, floatToHalf(value), index);
+	}
+
+	float getValueBFloat16(const FieldListEntry* field, uint32_t entry, uint32_t index = 0) const
+	{
+		return bfloat16ToFloat(getValue<uint16_t>(field, entry, index));
+	}
+
+	void setValueBFloat16(const FieldListEntry* field, uint32_t entry, float value, uint32_t index = 0)
+	{
+		setValue<uint16_t>(field, entry, floatToBFloat16(value), index);
+	}
+
+	// Converts the values of numEntries entries from firstEntry on of a FLOAT16 or BFLOAT16
+	// column to float, arraySize values per entry. Returns false for other columns
+	bool getFloatValues(const FieldListEntry* field, uint32_t firstEntry, uint32_t numEntries, float* dst) const
+	{
+		DataType dataType = getFieldDataType(field);
+		if((dataType != FLOAT16 && dataType != BFLOAT16) || isList(field) || (uint64_t)firstEntry + numEntries > getNumEntries())
+		{
+			return false;
+		}
+		uint32_t n = numEntries * field->arraySize;
+		const unsigned char* src = (const unsigned char*)getValuePtr(field, firstEntry);
+		recordRead(field, n * 2);
+		bool swap = needsByteswap();
+		uint32_t i = 0;
+		if(dataType == FLOAT16)
+		{
+#if defined(__F16C__)
+			if(!swap)
+			{
+				for (; i + 8 <= n; i += 8)
+				{
+					_mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i * 2))));
+				}
+			}
+#endif
+			for (; i < n; i++)
+			{
+				dst[i] = halfToFloat(loadTableValue<uint16_t>(src + i * 2, swap));
+			}
+		}
+		else
+		{
+			for (; i < n; i++)
+			{
+				dst[i] = bfloat16ToFloat(loadTableValue<uint16_t>(src + i * 2, swap));
+			}
+		}
+		return true;
+	}
+
+	// Stores floats in a FLOAT16 or BFLOAT16 column, rounding to nearest even and marking
+	// the entries valid. Returns false for other columns
+	bool setFloatValues(const FieldListEntry* field, uint32_t firstEntry, uint32_t numEntries, const float* src)
+	{
+		DataType dataType = getFieldDataType(field);
+		if((dataType != FLOAT16 && dataType != BFLOAT16) || isList(field) || (uint64_t)firstEntry + numEntries > getNumEntries())
+		{
+			return false;
+		}
+		uint32_t n = numEntries * field->arraySize;
+		unsigned char* dst = (unsigned char*)getValuePtr(field, firstEntry);
+		bool swap = needsByteswap();
+		uint32_t i = 0;
+		if(dataType == FLOAT16)
+		{
+#if defined(__F16C__)
+			if(!swap)
+			{
+				for (; i + 8 <= n; i += 8)
+				{
+					_mm_storeu_si128((__m128i*)(dst + i * 2), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+				}
+			}
+#endif
+			for (; i < n; i++)
+			{
+				storeTableValue<uint16_t>(dst + i * 2, floatToHalf(src[i]), swap);
+			}
+		}
+		else
+		{
+			for (; i < n; i++)
+			{
+				storeTableValue<uint16_t>(dst + i * 2, floatToBFloat16(src[i]), swap);
+			}
+		}
+		for (uint32_t entry = firstEntry; entry < firstEntry + numEntries; entry++)
+		{
+			setValid(field, entry, true);
+		}
+		return true;
+	}
+
+	static float halfToFloat(uint16_t h)
+	{
+#if defined(__F16C__)
+		return _cvtsh_ss(h);
+#else
+		return halfToFloatSoftware(h);
+#endif
+	}
+
+	// Rounds to nearest even, overflows to infinity
+	static uint16_t floatToHalf(float f)
+	{
+#if defined(__F16C__)
+		return _cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT);
+#else
+		return floatToHalfSoftware(f);
+#endif
+	}
+
+	// Fallbacks of halfToFloat() / floatToHalf() giving the same results as F16C:
+	// NaNs keep their payload and come out quiet
+	static float halfToFloatSoftware(uint16_t h)
+	{
+		uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+		uint32_t exponent = (h >> 10) & 0x1F;
+		uint32_t mantissa = h & 0x3FF;
+		uint32_t bits;
+		if(exponent == 0x1F)
+		{
+			bits = sign | 0x7F800000 | (mantissa << 13) | (mantissa != 0 ? 0x400000 : 0);
+		}
+		else if(exponent != 0)
+		{
+			bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+		}
+		else if(mantissa == 0)
+		{
+			bits = sign;
+		}
+		else
+		{
+			// Subnormal, normalize the mantissa
+			exponent = 113;
+			while((mantissa & 0x400) == 0)
+			{
+				mantissa <<= 1;
+				exponent--;
+			}
+			bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+		}
+		float f;
+		memcpy(&f, &bits, 4);
+		return f;
+	}
+
+	static uint16_t floatToHalfSoftware(float f)
+	{
+		uint32_t x;
+		memcpy(&x, &f, 4);
+		uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+		x &= 0x7FFFFFFF;
+		if(x >= 0x7F800000)
+		{
+			return sign | (x > 0x7F800000 ? 0x7E00 | ((x >> 13) & 0x3FF) : 0x7C00);
+		}
+		if(x >= 0x477FF000)
+		{
+			return sign | 0x7C00;
+		}
+		if(x < 0x38800000)
+		{
+			// Subnormal half, below 2^-25 rounds to zero
+			if(x < 0x33000000)
+			{
+				return sign;
+			}
+			uint32_t shift = 126 - (x >> 23);
+			uint32_t mantissa = (x & 0x7FFFFF) | 0x800000;
+			uint32_t rounded = mantissa >> shift;
+			uint32_t remainder = mantissa & ((1u << shift) - 1);
+			uint32_t halfway = 1u << (shift - 1);
+			if(remainder > halfway || (remainder == halfway && (rounded & 1)))
+			{
+				rounded++;
+			}
+			return sign | (uint16_t)rounded;
+		}
+		x -= 0x38000000; // Rebias the exponent from 127 to 15
+		return sign | (uint16_t)((x + 0xFFF + ((x >> 13) & 1)) >> 13);
+	}
+
+	static float bfloat16ToFloat(uint16_t b)
+	{
+		uint32_t bits = (uint32_t)b << 16;
+		float f;
+		memcpy(&f, &bits, 4);
+		return f;
+	}
+
+	// Rounds to nearest even, NaNs stay NaNs
+	static uint16_t floatToBFloat16(float f)
+	{
+		uint32_t x;
+		memcpy(&x, &f, 4);
+		if((x & 0x7FFFFFFF) > 0x7F800000)
+		{
+			return (uint16_t)((x >> 16) | 0x40);
+		}
+		return (uint16_t)((x + 0x7FFF + ((x >> 16) & 1)) >> 16);
+	}
+
+/* ------------------------------ Batch iteration ----------------------------- */
+
+	// Column base pointers and strides, resolved once per batch range
+	struct ColumnBase
+	{
+		const unsigned char* values;
+		const uint8_t* validity;
+		uint32_t stride;
+		bool typed; // Native byte order (or single byte values), not bit-packed and not a list, see Batch::column()
+	};
+
+	// Rows [getFirstEntry(), getFirstEntry() + size()) of the columns of a batch range
+	class Batch
+	{
+	public:
+		Batch() : m_columns(nullptr), m_first(0), m_size(0)
+		{
+
+		}
+
+		Batch(const ColumnBase* columns, uint32_t first, uint32_t size) : m_columns(columns), m_first(first), m_size(size)
+		{
+
+		}
+
+		uint32_t getFirstEntry() const
+		{
+			return m_first;
+		}
+
+		uint32_t size() const
+		{
+			return m_size;
+		}
+
+		// Values of column i for the rows of this batch, arraySize values per row. nullptr if
+		// the column is a list, needs a byteswap or is bit-packed, use columnData() and
+		// loadValue() for the latter two
+		template <typename V>
+		const V* column(uint32_t i) const
+		{
+			if(!m_columns[i].typed)
+			{
+				return nullptr;
+			}
+			return (const V*)(m_columns[i].values + (size_t)m_first * m_columns[i].stride);
+		}
+
+		// Raw values of column i for the rows of this batch, in the table byte order.
+		// nullptr for list columns
+		const void* columnData(uint32_t i) const
+		{
+			if(!m_columns[i].values)
+			{
+				return nullptr;
+			}
+			return m_columns[i].values + (size_t)m_first * m_columns[i].stride;
+		}
+
+		// row is relative to the batch
+		bool isValid(uint32_t i, uint32_t row) const
+		{
+			return !m_columns[i].validity || BTableBitmap::get(m_columns[i].validity, m_first + row);
+		}
+
+	private:
+		const ColumnBase* m_columns;
+		uint32_t m_first;
+		uint32_t m_size;
+	};
+
+	class BatchIterator
+	{
+	public:
+		typedef std::input_iterator_tag iterator_category;
+		typedef std::forward_iterator_tag iterator_concept;
+		typedef Batch value_type;
+		typedef Batch reference;
+		typedef std::ptrdiff_t difference_type;
+		typedef void pointer;
+
+		BatchIterator() : m_columns(nullptr), m_entry(0), m_numEntries(0), m_batchSize(0)
+		{
+
+		}
+
+		BatchIterator(const ColumnBase* columns, uint32_t entry, uint32_t numEntries, uint32_t batchSize) :
+			m_columns(columns), m_entry(entry), m_numEntries(numEntries), m_batchSize(batchSize)
+		{
+
+		}
+
+		Batch operator*() const
+		{
+			uint32_t remaining = m_numEntries - m_entry;
+			return Batch(m_columns, m_entry, remaining < m_batchSize ? remaining : m_batchSize);
+		}
+
+		BatchIterator& operator++()
+		{
+			uint32_t remaining = m_numEntries - m_entry;
+			m_entry += remaining < m_batchSize ? remaining : m_batchSize;
+			return *this;
+		}
+
+		BatchIterator operator++(int)
+		{
+			BatchIterator previous = *this;
+			++*this;
+			return previous;
+		}
+
+		bool operator==(const BatchIterator& other) const
+		{
+			return m_entry == other.m_entry;
+		}
+
+		bool operator!=(const BatchIterator& other) const
+		{
+			return m_entry != other.m_entry;
+		}
+
+	private:
+		const ColumnBase* m_columns;
+		uint32_t m_entry;
+		uint32_t m_numEntries;
+		uint32_t m_batchSize;
+	};
+
+	// Iterates a table in batches of batchSize rows, usable with range-for and std::ranges.
+	// Iterators stay valid while the range is alive
+	class BatchRange
+	{
+	public:
+		BatchRange(std::vector<ColumnBase>&& columns, uint32_t numEntries, uint32_t batchSize) :
+			m_columns(std::move(columns)), m_numEntries(numEntries), m_batchSize(batchSize == 0 ? 1 : batchSize)
+		{
+
+		}
+
+		BatchIterator begin() const
+		{
+			return BatchIterator(m_columns.data(), 0, m_numEntries, m_batchSize);
+		}
+
+		BatchIterator end() const
+		{
+			return BatchIterator(m_columns.data(), m_numEntries, m_numEntries, m_batchSize);
+		}
+
+		uint32_t getNumColumns() const
+		{
+			return (uint32_t)m_columns.size();
+		}
+
+	private:
+		std::vector<ColumnBase> m_columns;
+		uint32_t m_numEntries;
+		uint32_t m_batchSize;
+	};
+
+	// Batches over fixed size columns, column i of a batch is fields[i].
+	// Bit-packed columns have stride 0, read them with getValueBool().
+	// List columns are rejected, column() and columnData() return nullptr for them
+	BatchRange batches(const FieldListEntry* const* fields, uint32_t numFields, uint32_t batchSize = 1024) const
+	{
+		std::vector<ColumnBase> columns(numFields);
+		for (uint32_t i = 0; i < numFields; i++)
+		{
+			if(isList(fields[i]))
+			{
+				columns[i] = { nullptr, getValidityBitmap(fields[i]), 0, false };
+				continue;
+			}
+			columns[i].values = (const unsigned char*)getValuePtr(fields[i], 0);
+			columns[i].validity = getValidityBitmap(fields[i]);
+			columns[i].stride = getBytesPerEntry(fields[i]);
+			DataType dataType = getFieldDataType(fields[i]);
+			columns[i].typed = !isBitPacked(dataType) && (!needsByteswap() || getDatatypeSize(dataType) == 1);
+		}
+		return BatchRange(std::move(columns), getNumEntries(), batchSize);
+	}
+
+	BatchRange batches(std::initializer_list<const FieldListEntry*> fields, uint32_t batchSize = 1024) const
+	{
+		return batches(fields.begin(), (uint32_t)fields.size(), batchSize);
+	}
+
+/* ---------------------------------- Gather ---------------------------------- */
+
+	struct GatherOptions
+	{
+		uint32_t prefetchDistance = 16; // Entries ahead to prefetch, 0 disables prefetching
+		bool sortBatches = false; // Visit the entries of each batch in ascending order
+		uint32_t batchSize = 1024;
+	};
+
+	// Copies the values of the given entries of each column into a dense buffer per column:
+	// outputs[c] receives numIndices * getBytesPerEntry(fields[c]) bytes in the table byte order.
+	// The output order always matches entries. Prefetching hides the latency of random reads;
+	// with sortBatches the reads of a batch are done in ascending entry order, which helps
+	// when the indices are not ordered and cluster within a batch.
+	// Validity is not gathered, use isValid() for nullable columns.
+	// Returns false for list or bit-packed columns or if an entry is out of range
+	bool gather(const FieldListEntry* const* fields, uint32_t numFields, const uint32_t* entries, uint32_t numIndices, void* const* outputs, const GatherOptions& options = GatherOptions()) const
+	{
+		for (uint32_t c = 0; c < numFields; c++)
+		{
+			if(isList(fields[c]) || isBitPacked(getFieldDataType(fields[c])))
+			{
+				return false;
+			}
+		}
+		uint32_t numEntries = getNumEntries();
+		for (uint32_t i = 0; i < numIndices; i++)
+		{
+			if(entries[i] >= numEntries)
+			{
+				return false;
+			}
+		}
+
+		if constexpr (Instrumentation::enabled)
+		{
+			this->beginOperation(Instrumentation::Scan);
+		}
+		uint64_t bytes = 0;
+		uint32_t batchSize = options.batchSize == 0 ? 1 : options.batchSize;
+		std::vector<uint64_t> sorted;
+		for (uint32_t first = 0; first < numIndices; first += batchSize)
+		{
+			uint32_t n = numIndices - first < batchSize ? numIndices - first : batchSize;
+			if(options.sortBatches)
+			{
+				// Entry in the upper, output position in the lower half
+				sorted.resize(n);
+				for (uint32_t i = 0; i < n; i++)
+				{
+					sorted[i] = ((uint64_t)entries[first + i] << 32) | (first + i);
+				}
+				std::sort(sorted.begin(), sorted.end());
+			}
+			for (uint32_t c = 0; c < numFields; c++)
+			{
+				uint32_t stride = getBytesPerEntry(fields[c]);
+				const unsigned char* base = (const unsigned char*)getValuePtr(fields[c], 0);
+				unsigned char* out = (unsigned char*)outputs[c];
+				switch (stride)
+				{
+				case 1: gatherColumn<1>(base, stride, entries, sorted, first, n, out, options); break;
+				case 2: gatherColumn<2>(base, stride, entries, sorted, first, n, out, options); break;
+				case 4: gatherColumn<4>(base, stride, entries, sorted, first, n, out, options); break;
+				case 8: gatherColumn<8>(base, stride, entries, sorted, first, n, out, options); break;
+				default: gatherColumn<0>(base, stride, entries, sorted, first, n, out, options); break;
+				}
+				bytes += (uint64_t)stride * n;
+				recordRead(fields[c], stride * n);
+			}
+		}
+		if constexpr (Instrumentation::enabled)
+		{
+			this->endOperation(Instrumentation::Scan, numIndices, bytes);
+		}
+		return true;
+	}
+
+	bool gather(std::initializer_list<const FieldListEntry*> fields, const uint32_t* entries, uint32_t numIndices, std::initializer_list<void*> outputs, const GatherOptions& options = GatherOptions()) const
+	{
+		if(fields.size() != outputs.size())
+		{
+			return false;
+		}
+		return gather(fields.begin(), (uint32_t)fields.size(), entries, numIndices, outputs.begin(), options);
+	}
+
+	static void prefetch(const void* ptr)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		__builtin_prefetch(ptr, 0, 3);
+#elif defined(_MSC_VER)
+		_mm_prefetch((const char*)ptr, _MM_HINT_T0);
+#else
+		(void)ptr;
+#endif
+	}
+
+/* -------------------------- Type specific setters ------------------------- */
+
+	// sets only a single value
+	void setValueInt8(const FieldListEntry* field, uint32_t entry, uint8_t value)
+	{
+		// check if arraySize is != 1 and throw error
+		*(uint8_t*)getValuePtr(field, entry) = value;
+		setValid(field, entry, true);
+	}
+
+	// sets the array of an entry
+	void setArrayInt8(const FieldListEntry* field, uint32_t entry, int8_t* srcArray, uint32_t n)
+	{
+		// Add error handling of dest size < src size
+		void* startPtr = getValuePtr(field, entry);
+		if(field->arraySize > n)
+		{
+			n = field->arraySize;
+		}
+		memcpy(startPtr, srcArray, n);
+		setValid(field, entry, true);
+	}
+
+	// sets every entry in a column. only for single values, not arrays.
+	// n is clamped to the end of the column, the written entries become valid
+	void setEntries(const FieldListEntry* field, uint32_t startEntry, int8_t* srcArray, uint32_t n)
+	{
+		// check if arraySize is != 1 and throw error
+		void* startPtr = (int8_t*)getEntries(field) + startEntry;
+		uint32_t dstSize = getNumEntries() - startEntry;
+		if(n > dstSize)
+		{
+			n = dstSize;
+		}
+		memcpy(startPtr, srcArray, n);
+		uint8_t* validity = getValidityBitmap(field);
+		if(validity)
+		{
+			BTableBitmap::fillRange(validity, startEntry, startEntry + n, true);
+		}
+	}
+
+/* -------------------------- Type specific getters ------------------------- */
+
+	int8_t getValueInt8(const FieldListEntry* field, uint32_t entry) const
+	{
+		recordRead(field, 1);
+		return *(uint8_t*)getValuePtr(field, entry);
+	}
+
+	int8_t getValueInt8Array(const FieldListEntry* field, uint32_t entry, uint16_t index) const
+	{
+		// TODO: add error checking
+		recordRead(field, 1);
+		return ((uint8_t*)getValuePtr(field, entry))[index];
+	}
+
+private:
+	// loadValue() / storeValue() reporting the byteswaps of data values
+	template <typename V>
+	V loadTableValue(const void* ptr, bool swap) const
+	{
+		recordByteswap<V>(swap);
+		return loadValue<V>(ptr, swap);
+	}
+
+	template <typename V>
+	void storeTableValue(void* ptr, V value, bool swap) const
+	{
+		recordByteswap<V>(swap);
+		storeValue<V>(ptr, value, swap);
+	}
+
+	template <typename V>
+	void recordByteswap(bool swap) const
+	{
+		if constexpr (Instrumentation::enabled)
+		{
+			if(swap && sizeof(V) > 1)
+			{
+				this->onByteswap(1);
+			}
+		}
+	}
+
+	uint32_t loadBe32(uint32_t x) const
+	{
+		if constexpr (Instrumentation::enabled)
+		{
+			this->onByteswap(is_little_endian_cpu ? 1 : 0);
+		}
+		return be32_to_cpu(x);
+	}
+
+	uint16_t loadBe16(uint16_t x) const
+	{
+		if constexpr (Instrumentation::enabled)
+		{
+			this->onByteswap(is_little_endian_cpu ? 1 : 0);
+		}
+		return be16_to_cpu(x);
+	}
+
+	// Size is the value size known at compile time, 0 for other sizes
+	template <uint32_t Size>
+	static void gatherColumn(const unsigned char* base, uint32_t stride, const uint32_t* entries, const std::vector<uint64_t>& sorted, uint32_t first, uint32_t n, unsigned char* out, const GatherOptions& options)
+	{
+		uint32_t distance = options.prefetchDistance;
+		for (uint32_t i = 0; i < n; i++)
+		{
+			uint32_t entry;
+			uint32_t position;
+			if(options.sortBatches)
+			{
+				if(distance != 0 && i + distance < n)
+				{
+					prefetch(base + (size_t)(sorted[i + distance] >> 32) * stride);
+				}
+				entry = (uint32_t)(sorted[i] >> 32);
+				position = (uint32_t)sorted[i];
+			}
+			else
+			{
+				if(distance != 0 && i + distance < n)
+				{
+					prefetch(base + (size_t)entries[first + i + distance] * stride);
+				}
+				entry = entries[first + i];
+				position = first + i;
+			}
+			if constexpr (Size != 0)
+			{
+				memcpy(out + (size_t)position * Size, base + (size_t)entry * Size, Size);
+			}
+			else
+			{
+				memcpy(out + (size_t)position * stride, base + (size_t)entry * stride, stride);
+			}
+		}
+	}
+
+	// Offset of the first byte after the values of a column from start of data section
+	uint64_t getValuesEnd(const FieldListEntry* field, uint64_t numEntries) const
+	{
+		uint64_t offset = loadBe32(field->offset);
+		if(isList(field))
+		{
+			return getListValuesOffset(offset, numEntries, getColumnAlignment()) + (uint64_t)getDatatypeSize(getFieldDataType(field)) * getListCapacity(field);
+		}
+		return offset + getValuesSize(getFieldDataType(field), field->arraySize, numEntries);
+	}
+
+	uint64_t getValuesEnd(const FieldListEntry* field) const
+	{
+		return getValuesEnd(field, getNumEntries());
+	}
+
+	// Start of the values of entry if it is the next list to append and n more values fit.
+	// The last offset holds the number of values in use while lists are appended, see
+	// storeListEnd(), so the next entry is the one starting there
+	bool getListAppendStart(const FieldListEntry* field, uint32_t entry, uint32_t n, uint32_t* start) const
+	{
+		uint32_t numEntries = getNumEntries();
+		if(entry >= numEntries)
+		{
+			return false;
+		}
+		*start = getListOffset(field, entry);
+		if(*start != getListOffset(field, numEntries))
+		{
+			return false;
+		}
+		return (uint64_t)*start + n <= getListCapacity(field);
+	}
+
+	void storeListEnd(const FieldListEntry* field, uint32_t entry, uint32_t end, bool swap)
+	{
+		unsigned char* offsets = (unsigned char*)getEntries(field) + 4;
+		storeTableValue<uint32_t>(offsets + (entry + 1) * 4, end, swap);
+		storeTableValue<uint32_t>(offsets + getNumEntries() * 4, end, swap);
+	}
+
+	void recordRead(const FieldListEntry* field, uint32_t bytes) const
+	{
+		if constexpr (Instrumentation::enabled)
+		{
+			this->onRead(getFieldIndex(field), bytes);
+		}
+	}
+
+	void* getValuePtr(const FieldListEntry* field, uint32_t entry)
+	{
+		return bufferPtr + loadBe16(getHeader()->dataOffset) + loadBe32(field->offset) + (size_t)getDatatypeBits(getFieldDataType(field)) * field->arraySize * entry / 8;
+	}
+
+	T bufferPtr;
+	uint32_t m_size;
+};
+
+typedef BTableGeneric<unsigned char*> BTable;
+typedef BTableGeneric<const unsigned char*> BTableReadOnly;
+
+template <typename Instrumentation>
+using BTableInstrumented = BTableGeneric<unsigned char*, Instrumentation>;
+
+template <typename Instrumentation>
+using BTableReadOnlyInstrumented = BTableGeneric<const unsigned char*, Instrumentation>;
@@ -0,0 +1,327 @@
+#pragma once
+
+#include "btable.h"
+
+#include <algorithm>
+#include <vector>
+
+// Binary patches between two versions of a table, for shipping updates to replicas that
+// already hold the old version. A patch lists the byte ranges of the new buffer that differ
+// from the old one at the same offset; everything else is kept as is. Column values are
+// compared in blocks of whole entries, so the ranges of a column are changed entry ranges.
+// Schema changes need no special handling: the header and field list are diffed like any
+// other bytes, and bytes past the end of the old buffer are always sent.
+// The patch carries block hashes (see hash()) of the old and the new buffer: a replica
+// that missed an update rejects the patch instead of ending up with a mix of versions,
+// and the patched result is checked before anything is written.
+//
+// Patch layout, all integers big-endian:
+//   [magic u32][oldSize u32][newSize u32][numRanges u32][oldHash u64][newHash u64]
+//   numRanges times [offset u32][length u32][length bytes], ascending and disjoint
+struct BTableDiff
+{
+	static constexpr uint32_t magic = 0x42544450; // "BTDP"
+	static constexpr uint32_t header_size = 32;
+	static constexpr uint32_t range_header_size = 8;
+	static constexpr uint32_t block_size = 4096; // Bytes compared and hashed at once
+
+	// Hash of a buffer, combined from the hashes of its block_size blocks. Not cryptographic,
+	// it detects a wrong base version or a damaged patch. Independent of the CPU byte order
+	static uint64_t hash(const unsigned char* data, uint32_t size)
+	{
+		uint64_t h = mix(size);
+		for (uint32_t block = 0; block < size; block += block_size)
+		{
+			uint32_t n = size - block < block_size ? size - block : block_size;
+			h = mix(h ^ hashBlock(data + block, n));
+		}
+		return h;
+	}
+
+	// Writes the patch turning oldTable into newTable. newTable has to be valid, oldTable
+	// may be anything, including a table with a different schema. Returns false if
+	// newTable is not valid
+	template <typename OldTable, typename NewTable>
+	static bool create(const OldTable& oldTable, const NewTable& newTable, std::vector<unsigned char>& patch)
+	{
+		if(!newTable.validate())
+		{
+			return false;
+		}
+		Writer writer(patch, (const unsigned char*)oldTable.getHeader(), oldTable.getBufferSize(), (const unsigned char*)newTable.getHeader(), newTable.getBufferSize());
+
+		// Non-list column values are compared per entry, everything in between
+		// (header, field list, validity bitmaps, list columns, padding) per 8 bytes
+		struct Segment
+		{
+			uint32_t start;
+			uint32_t end;
+			uint32_t unit;
+		};
+		std::vector<Segment> columns;
+		const unsigned char* base = (const unsigned char*)newTable.getHeader();
+		for (uint32_t i = 0; i < newTable.getNumFields(); i++)
+		{
+			const auto* field = newTable.getField(i);
+			uint32_t stride = NewTable::getBytesPerEntry(field);
+			if(NewTable::isList(field) || stride == 0)
+			{
+				continue;
+			}
+			uint32_t start = (uint32_t)((const unsigned char*)newTable.getEntries(field) - base);
+			columns.push_back({ start, start + stride * newTable.getNumEntries(), stride });
+		}
+		std::sort(columns.begin(), columns.end(), [](const Segment& a, const Segment& b) { return a.start < b.start; });
+
+		uint32_t position = 0;
+		for (const Segment& column : columns)
+		{
+			if(column.start < position)
+			{
+				continue;
+			}
+			writer.compare(position, column.start, 8);
+			writer.compare(column.start, column.end, column.unit);
+			position = column.end;
+		}
+		writer.compare(position, newTable.getBufferSize(), 8);
+		writer.finish();
+		return true;
+	}
+
+	// Applies a patch to the buffer holding the old table of size bytes. The buffer has to
+	// be at least the new size (capacity); on success newSize receives the size of the
+	// patched table. Nothing is written if the patch is malformed, the buffer is not the
+	// version the patch was created from, or the result would not match the new version.
+	// Reads the buffer twice for the hashes before writing
+	static bool apply(unsigned char* buffer, uint32_t size, uint32_t capacity, const unsigned char* patch, uint32_t patchSize, uint32_t* newSize)
+	{
+		if(patchSize < header_size || load32(patch) != magic || load32(patch + 4) != size)
+		{
+			return false;
+		}
+		uint32_t targetSize = load32(patch + 8);
+		uint32_t numRanges = load32(patch + 12);
+		if(targetSize > capacity)
+		{
+			return false;
+		}
+
+		// Check every range before touching the buffer
+		struct Range
+		{
+			uint32_t offset;
+			uint32_t length;
+			const unsigned char* data;
+		};
+		std::vector<Range> ranges;
+		uint32_t position = header_size;
+		uint64_t previousEnd = 0;
+		for (uint32_t i = 0; i < numRanges; i++)
+		{
+			if(patchSize - position < range_header_size)
+			{
+				return false;
+			}
+			uint32_t offset = load32(patch + position);
+			uint32_t length = load32(patch + position + 4);
+			position += range_header_size;
+			if(offset < previousEnd || (uint64_t)offset + length > targetSize || patchSize - position < length)
+			{
+				return false;
+			}
+			ranges.push_back({ offset, length, patch + position });
+			previousEnd = (uint64_t)offset + length;
+			position += length;
+		}
+		if(position != patchSize || hash(buffer, size) != load64(patch + 16))
+		{
+			return false;
+		}
+
+		// Hash the result block by block without writing it
+		std::vector<unsigned char> block(block_size);
+		uint64_t h = mix(targetSize);
+		size_t range = 0;
+		for (uint32_t start = 0; start < targetSize; start += block_size)
+		{
+			uint32_t n = targetSize - start < block_size ? targetSize - start : block_size;
+			memcpy(block.data(), buffer + start, n);
+			while(range < ranges.size() && ranges[range].offset + ranges[range].length <= start)
+			{
+				range++;
+			}
+			for (size_t r = range; r < ranges.size() && ranges[r].offset < start + n; r++)
+			{
+				uint32_t from = ranges[r].offset > start ? ranges[r].offset : start;
+				uint32_t to = ranges[r].offset + ranges[r].length < start + n ? ranges[r].offset + ranges[r].length : start + n;
+				memcpy(block.data() + (from - start), ranges[r].data + (from - ranges[r].offset), to - from);
+			}
+			h = mix(h ^ hashBlock(block.data(), n));
+		}
+		if(h != load64(patch + 24))
+		{
+			return false;
+		}
+
+		for (const Range& r : ranges)
+		{
+			memcpy(buffer + r.offset, r.data, r.length);
+		}
+		*newSize = targetSize;
+		return true;
+	}
+
+	// Size of the table a patch produces, 0 if patch is no patch
+	static uint32_t getNewSize(const unsigned char* patch, uint32_t patchSize)
+	{
+		if(patchSize < header_size || load32(patch) != magic)
+		{
+			return 0;
+		}
+		return load32(patch + 8);
+	}
+
+private:
+	static uint64_t mix(uint64_t h)
+	{
+		h ^= h >> 33;
+		h *= 0xFF51AFD7ED558CCDull;
+		h ^= h >> 33;
+		h *= 0xC4CEB9FE1A85EC53ull;
+		h ^= h >> 33;
+		return h;
+	}
+
+	// Words are read little-endian so every CPU computes the same hash
+	static uint64_t hashBlock(const unsigned char* data, uint32_t n)
+	{
+		uint64_t h = 0x9E3779B97F4A7C15ull ^ n;
+		uint32_t i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			uint64_t word;
+			memcpy(&word, data + i, 8);
+			if(!BTable::is_little_endian_cpu)
+			{
+				word = BTable::byteswap64(word);
+			}
+			h = (h ^ word) * 0x100000001B3ull;
+			h ^= h >> 29;
+		}
+		for (; i < n; i++)
+		{
+			h = (h ^ data[i]) * 0x100000001B3ull;
+		}
+		return mix(h);
+	}
+
+	static uint64_t load64(const unsigned char* ptr)
+	{
+		return ((uint64_t)load32(ptr) << 32) | load32(ptr + 4);
+	}
+
+	static void store64(unsigned char* ptr, uint64_t x)
+	{
+		store32(ptr, (uint32_t)(x >> 32));
+		store32(ptr + 4, (uint32_t)x);
+	}
+
+	static uint32_t load32(const unsigned char* ptr)
+	{
+		uint32_t x;
+		memcpy(&x, ptr, 4);
+		return BTable::be32_to_cpu(x);
+	}
+
+	static void store32(unsigned char* ptr, uint32_t x)
+	{
+		x = BTable::cpu_to_be32(x);
+		memcpy(ptr, &x, 4);
+	}
+
+	class Writer
+	{
+	public:
+		Writer(std::vector<unsigned char>& patch, const unsigned char* oldBuffer, uint32_t oldSize, const unsigned char* newBuffer, uint32_t newSize) :
+			m_patch(patch), m_old(oldBuffer), m_oldSize(oldSize), m_new(newBuffer)
+		{
+			m_patch.resize(header_size);
+			store32(m_patch.data(), magic);
+			store32(m_patch.data() + 4, oldSize);
+			store32(m_patch.data() + 8, newSize);
+			store64(m_patch.data() + 16, hash(oldBuffer, oldSize));
+			store64(m_patch.data() + 24, hash(newBuffer, newSize));
+		}
+
+		// Adds the differences in [start, end), compared in units of unit bytes
+		void compare(uint32_t start, uint32_t end, uint32_t unit)
+		{
+			uint32_t comparable = end < m_oldSize ? end : (start > m_oldSize ? start : m_oldSize);
+			uint32_t blockBytes = block_size < unit ? unit : block_size - block_size % unit;
+			for (uint32_t block = start; block < comparable; block += blockBytes)
+			{
+				uint32_t blockEnd = comparable - block < blockBytes ? comparable : block + blockBytes;
+				if(memcmp(m_old + block, m_new + block, blockEnd - block) == 0)
+				{
+					continue;
+				}
+				for (uint32_t i = block; i < blockEnd; i += unit)
+				{
+					uint32_t n = blockEnd - i < unit ? blockEnd - i : unit;
+					if(memcmp(m_old + i, m_new + i, n) != 0)
+					{
+						add(i, i + n);
+					}
+				}
+			}
+			if(comparable < end)
+			{
+				add(comparable, end);
+			}
+		}
+
+		void finish()
+		{
+			flush();
+			store32(m_patch.data() + 12, m_numRanges);
+		}
+
+	private:
+		// Ranges closer than a range header are merged
+		void add(uint32_t start, uint32_t end)
+		{
+			if(m_rangeEnd != 0 && start <= m_rangeEnd + range_header_size)
+			{
+				m_rangeEnd = end;
+				return;
+			}
+			flush();
+			m_rangeStart = start;
+			m_rangeEnd = end;
+		}
+
+		void flush()
+		{
+			if(m_rangeEnd == 0)
+			{
+				return;
+			}
+			size_t position = m_patch.size();
+			m_patch.resize(position + range_header_size + (m_rangeEnd - m_rangeStart));
+			store32(m_patch.data() + position, m_rangeStart);
+			store32(m_patch.data() + position + 4, m_rangeEnd - m_rangeStart);
+			memcpy(m_patch.data() + position + range_header_size, m_new + m_rangeStart, m_rangeEnd - m_rangeStart);
+			m_numRanges++;
+			m_rangeEnd = 0;
+		}
+
+		std::vector<unsigned char>& m_patch;
+		const unsigned char* m_old;
+		uint32_t m_oldSize;
+		const unsigned char* m_new;
+		uint32_t m_numRanges = 0;
+		uint32_t m_rangeStart = 0;
+		uint32_t m_rangeEnd = 0; // 0 while no range is pending
+	};
+};
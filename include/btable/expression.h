@@ -0,0 +1,743 @@
+#pragma once
+
+#include "btable.h"
+
+#include <type_traits>
+#include <vector>
+
+// Expressions over columns and constants, evaluated in batches of batch_size rows.
+// Every node computes a whole batch in a tight loop over int64 or double lanes that the
+// compiler can vectorize. Nodes are stored in creation order, so children always precede
+// their parents and a batch is evaluated by a single pass over the nodes.
+// A row is null if any column the expression references is null; null rows never pass
+// filters, are skipped by sums and are stored as null in nullable target columns.
+// BOOL and integer columns load into int64 lanes (UINT64 values above INT64_MAX wrap),
+// FLOAT16 and BFLOAT16 columns into double lanes.
+class BTableExpression
+{
+public:
+	static constexpr uint32_t batch_size = 1024;
+
+	typedef uint32_t Node;
+
+	enum Op : uint8_t
+	{
+		Column = 0,
+		ConstantInt,
+		ConstantFloat,
+		Add,
+		Sub,
+		Mul,
+		Div, // Integer division by zero yields 0, integer overflow wraps around
+		Less,
+		LessEqual,
+		Greater,
+		GreaterEqual,
+		Equal,
+		NotEqual,
+		And,
+		Or,
+		Not,
+		CastInt,
+		CastFloat,
+		Select // children[0] ? children[1] : children[2]
+	};
+
+	enum Type : uint8_t
+	{
+		Int,
+		Float
+	};
+
+	// Values of the root node for rows [first, first + size), in ints or floats depending on
+	// type; the other pointer is nullptr. validity holds one bit per row of the batch and is
+	// nullptr if every row is valid
+	struct Result
+	{
+		uint32_t first;
+		uint32_t size;
+		Type type;
+		const int64_t* ints;
+		const double* floats;
+		const uint8_t* validity;
+	};
+
+	Node column(uint32_t fieldIndex)
+	{
+		NodeData node = {};
+		node.op = Column;
+		node.fieldIndex = fieldIndex;
+		return push(node);
+	}
+
+	Node constant(int64_t value)
+	{
+		NodeData node = {};
+		node.op = ConstantInt;
+		node.intValue = value;
+		return push(node);
+	}
+
+	Node constant(double value)
+	{
+		NodeData node = {};
+		node.op = ConstantFloat;
+		node.floatValue = value;
+		return push(node);
+	}
+
+	Node add(Node a, Node b) { return push(Add, a, b); }
+	Node sub(Node a, Node b) { return push(Sub, a, b); }
+	Node mul(Node a, Node b) { return push(Mul, a, b); }
+	Node div(Node a, Node b) { return push(Div, a, b); }
+	Node less(Node a, Node b) { return push(Less, a, b); }
+	Node lessEqual(Node a, Node b) { return push(LessEqual, a, b); }
+	Node greater(Node a, Node b) { return push(Greater, a, b); }
+	Node greaterEqual(Node a, Node b) { return push(GreaterEqual, a, b); }
+	Node equal(Node a, Node b) { return push(Equal, a, b); }
+	Node notEqual(Node a, Node b) { return push(NotEqual, a, b); }
+	Node logicalAnd(Node a, Node b) { return push(And, a, b); }
+	Node logicalOr(Node a, Node b) { return push(Or, a, b); }
+	Node logicalNot(Node a) { return push(Not, a); }
+	Node castInt(Node a) { return push(CastInt, a); }
+	Node castFloat(Node a) { return push(CastFloat, a); }
+	Node select(Node condition, Node a, Node b) { return push(Select, condition, a, b); }
+
+	uint32_t getNumNodes() const
+	{
+		return (uint32_t)m_nodes.size();
+	}
+
+	// Calls consumer(const Result&) for every batch. Returns false if the expression
+	// references a missing, string or list column
+	template <typename Table, typename F>
+	bool evaluate(const Table& table, Node root, F&& consumer) const
+	{
+		Evaluation<Table> evaluation(*this, table, root);
+		if(!evaluation.bind())
+		{
+			return false;
+		}
+		uint32_t numEntries = table.getNumEntries();
+		for (uint32_t first = 0; first < numEntries; first += batch_size)
+		{
+			uint32_t size = numEntries - first < batch_size ? numEntries - first : batch_size;
+			consumer(evaluation.run(first, size));
+		}
+		return true;
+	}
+
+	// Sets bit i of selection (BTableBitmap::getSize(getNumEntries()) bytes) if row i is valid
+	// and the predicate is not zero
+	template <typename Table>
+	bool filter(const Table& table, Node predicate, uint8_t* selection) const
+	{
+		return evaluate(table, predicate, [&](const Result& result)
+		{
+			for (uint32_t w = 0; w * 64 < result.size; w++)
+			{
+				uint32_t rows = result.size - w * 64 < 64 ? result.size - w * 64 : 64;
+				uint64_t word = result.type == Int ? packNonZero(result.ints + w * 64, rows) : packNonZero(result.floats + w * 64, rows);
+				if(result.validity)
+				{
+					word &= BTableBitmap::loadWord(result.validity, w);
+				}
+				BTableBitmap::storeWord(selection, result.first / 64 + w, word);
+			}
+		});
+	}
+
+	// Sums the valid rows, restricted to the set bits of selection if given
+	template <typename Table, typename Acc>
+	bool sum(const Table& table, Node root, Acc* total, const uint8_t* selection = nullptr, uint32_t* count = nullptr) const
+	{
+		Acc accumulated = 0;
+		uint32_t summed = 0;
+		bool ok = evaluate(table, root, [&](const Result& result)
+		{
+			for (uint32_t w = 0; w * 64 < result.size; w++)
+			{
+				uint64_t mask = BTableBitmap::wordMask(w, result.size);
+				if(result.validity)
+				{
+					mask &= BTableBitmap::loadWord(result.validity, w);
+				}
+				if(selection)
+				{
+					mask &= BTableBitmap::loadWord(selection, result.first / 64 + w);
+				}
+				summed += BTableBitmap::popcount64(mask);
+				if(result.type == Int)
+				{
+					accumulated += sumMasked<Acc>(result.ints + w * 64, mask);
+				}
+				else
+				{
+					accumulated += sumMasked<Acc>(result.floats + w * 64, mask);
+				}
+			}
+		});
+		*total = accumulated;
+		if(count)
+		{
+			*count = summed;
+		}
+		return ok;
+	}
+
+	// Stores the results in an existing fixed size column of the table, converted to its type.
+	// Null rows are stored as null if the column is nullable
+	template <typename Table>
+	bool materialize(Table& table, Node root, const typename Table::FieldListEntry* target) const
+	{
+		typename Table::DataType dataType = Table::getFieldDataType(target);
+		if(Table::isList(target) || dataType == Table::STRING)
+		{
+			return false;
+		}
+		unsigned char* base = (unsigned char*)table.getEntries(target);
+		uint32_t stride = Table::getBytesPerEntry(target);
+		bool swap = table.needsByteswap();
+		return evaluate((const Table&)table, root, [&](const Result& result)
+		{
+			unsigned char* dst = base + (size_t)result.first * stride;
+			if(Table::isBitPacked(dataType))
+			{
+				for (uint32_t i = 0; i < result.size; i++)
+				{
+					bool value = result.type == Int ? result.ints[i] != 0 : result.floats[i] != 0;
+					BTableBitmap::set(base, (result.first + i) * target->arraySize, value);
+				}
+			}
+			else if(result.type == Int)
+			{
+				storeColumn<Table>(dataType, result.ints, result.size, dst, stride, swap);
+			}
+			else
+			{
+				storeColumn<Table>(dataType, result.floats, result.size, dst, stride, swap);
+			}
+			if(Table::isNullable(target))
+			{
+				for (uint32_t i = 0; i < result.size; i++)
+				{
+					table.setValid(target, result.first + i, !result.validity || BTableBitmap::get(result.validity, i));
+				}
+			}
+		});
+	}
+
+private:
+	struct NodeData
+	{
+		Op op;
+		uint32_t fieldIndex;
+		Node children[3];
+		int64_t intValue;
+		double floatValue;
+	};
+
+	Node push(const NodeData& node)
+	{
+		m_nodes.push_back(node);
+		return (Node)(m_nodes.size() - 1);
+	}
+
+	Node push(Op op, Node a, Node b = 0, Node c = 0)
+	{
+		NodeData node = {};
+		node.op = op;
+		node.children[0] = a;
+		node.children[1] = b;
+		node.children[2] = c;
+		return push(node);
+	}
+
+	static uint32_t getNumChildren(Op op)
+	{
+		switch (op)
+		{
+		case Column:
+		case ConstantInt:
+		case ConstantFloat: return 0;
+		case Not:
+		case CastInt:
+		case CastFloat: return 1;
+		case Select: return 3;
+		default: return 2;
+		}
+	}
+
+	// Float to integer conversions saturate and map NaN to 0
+	static int64_t toInt64(double x)
+	{
+		if(x != x)
+		{
+			return 0;
+		}
+		if(x >= 9223372036854775808.0)
+		{
+			return INT64_MAX;
+		}
+		if(x < -9223372036854775808.0)
+		{
+			return INT64_MIN;
+		}
+		return (int64_t)x;
+	}
+
+	static int64_t toInt64(int64_t x)
+	{
+		return x;
+	}
+
+	template <typename V>
+	static uint64_t packNonZero(const V* values, uint32_t rows)
+	{
+		uint64_t word = 0;
+		for (uint32_t i = 0; i < rows; i++)
+		{
+			word |= (uint64_t)(values[i] != 0) << i;
+		}
+		return word;
+	}
+
+	template <typename Acc, typename V>
+	static Acc sumMasked(const V* values, uint64_t mask)
+	{
+		Acc total = 0;
+		if(mask == ~(uint64_t)0)
+		{
+			for (uint32_t i = 0; i < 64; i++)
+			{
+				total += (Acc)values[i];
+			}
+			return total;
+		}
+		while(mask)
+		{
+			total += (Acc)values[BTableBitmap::countTrailingZeros64(mask)];
+			mask &= mask - 1;
+		}
+		return total;
+	}
+
+	template <typename Table, typename V, typename R>
+	static void loadColumn(const unsigned char* base, uint32_t stride, bool swap, uint32_t n, R* out)
+	{
+		if(!swap && stride == sizeof(V))
+		{
+			const V* values = (const V*)base;
+			for (uint32_t i = 0; i < n; i++)
+			{
+				out[i] = (R)values[i];
+			}
+			return;
+		}
+		for (uint32_t i = 0; i < n; i++)
+		{
+			out[i] = (R)Table::template loadValue<V>(base + (size_t)i * stride, swap);
+		}
+	}
+
+	// Loads 16 bit floats through a conversion to float
+	template <typename Table, typename R, typename F>
+	static void loadConverted(const unsigned char* base, uint32_t stride, bool swap, uint32_t n, R* out, F convert)
+	{
+		for (uint32_t i = 0; i < n; i++)
+		{
+			out[i] = (R)convert(Table::template loadValue<uint16_t>(base + (size_t)i * stride, swap));
+		}
+	}
+
+	template <typename Table, typename R, typename F>
+	static void storeConverted(const R* values, uint32_t n, unsigned char* dst, uint32_t stride, bool swap, F convert)
+	{
+		for (uint32_t i = 0; i < n; i++)
+		{
+			Table::template storeValue<uint16_t>(dst + (size_t)i * stride, convert((float)values[i]), swap);
+		}
+	}
+
+	template <typename Table, typename V, typename R>
+	static void storeValues(const R* values, uint32_t n, unsigned char* dst, uint32_t stride, bool swap)
+	{
+		for (uint32_t i = 0; i < n; i++)
+		{
+			if constexpr (std::is_integral<V>::value)
+			{
+				Table::template storeValue<V>(dst + (size_t)i * stride, (V)toInt64(values[i]), swap);
+			}
+			else
+			{
+				Table::template storeValue<V>(dst + (size_t)i * stride, (V)values[i], swap);
+			}
+		}
+	}
+
+	template <typename Table, typename R>
+	static void storeColumn(typename Table::DataType dataType, const R* values, uint32_t n, unsigned char* dst, uint32_t stride, bool swap)
+	{
+		switch (dataType)
+		{
+		case Table::INT8: storeValues<Table, int8_t>(values, n, dst, stride, swap); break;
+		case Table::INT16: storeValues<Table, int16_t>(values, n, dst, stride, swap); break;
+		case Table::INT32: storeValues<Table, int32_t>(values, n, dst, stride, swap); break;
+		case Table::INT64: storeValues<Table, int64_t>(values, n, dst, stride, swap); break;
+		case Table::FLOAT32: storeValues<Table, float>(values, n, dst, stride, swap); break;
+		case Table::FLOAT64: storeValues<Table, double>(values, n, dst, stride, swap); break;
+		case Table::FLOAT16: storeConverted<Table>(values, n, dst, stride, swap, Table::floatToHalf); break;
+		case Table::BFLOAT16: storeConverted<Table>(values, n, dst, stride, swap, Table::floatToBFloat16); break;
+		case Table::UINT8: storeValues<Table, uint8_t>(values, n, dst, stride, swap); break;
+		case Table::UINT16: storeValues<Table, uint16_t>(values, n, dst, stride, swap); break;
+		case Table::UINT32: storeValues<Table, uint32_t>(values, n, dst, stride, swap); break;
+		case Table::UINT64: storeValues<Table, uint64_t>(values, n, dst, stride, swap); break;
+		default: break;
+		}
+	}
+
+	// Per call scratch space: one batch of lanes per node the root depends on, in the lanes
+	// of the node's type only
+	template <typename Table>
+	class Evaluation
+	{
+	public:
+		Evaluation(const BTableExpression& expression, const Table& table, Node root) :
+			m_expression(expression), m_table(table), m_root(root)
+		{
+
+		}
+
+		// Resolves columns and result types, marks the nodes the root depends on
+		bool bind()
+		{
+			const std::vector<NodeData>& nodes = m_expression.m_nodes;
+			if(m_root >= nodes.size())
+			{
+				return false;
+			}
+			m_types.assign(m_root + 1, Int);
+			m_needed.assign(m_root + 1, false);
+			m_fields.assign(m_root + 1, nullptr);
+			m_needed[m_root] = true;
+			for (uint32_t i = m_root + 1; i-- > 0;)
+			{
+				if(!m_needed[i])
+				{
+					continue;
+				}
+				for (uint32_t c = 0; c < getNumChildren(nodes[i].op); c++)
+				{
+					if(nodes[i].children[c] >= i)
+					{
+						return false;
+					}
+					m_needed[nodes[i].children[c]] = true;
+				}
+			}
+
+			for (uint32_t i = 0; i <= m_root; i++)
+			{
+				if(!m_needed[i])
+				{
+					continue;
+				}
+				const NodeData& node = nodes[i];
+				const Node* children = node.children;
+				switch (node.op)
+				{
+				case Column:
+				{
+					const typename Table::FieldListEntry* field = m_table.getField(node.fieldIndex);
+					if(!field || Table::isList(field) || Table::getFieldDataType(field) == Table::STRING)
+					{
+						return false;
+					}
+					typename Table::DataType dataType = Table::getFieldDataType(field);
+					bool isFloat = dataType == Table::FLOAT32 || dataType == Table::FLOAT64 || dataType == Table::FLOAT16 || dataType == Table::BFLOAT16;
+					m_types[i] = isFloat ? Float : Int;
+					m_fields[i] = field;
+					if(Table::isNullable(field))
+					{
+						m_nullable.push_back(field);
+					}
+					break;
+				}
+				case ConstantFloat:
+				case CastFloat:
+					m_types[i] = Float;
+					break;
+				case Add:
+				case Sub:
+				case Mul:
+				case Div:
+					m_types[i] = m_types[children[0]] == Float || m_types[children[1]] == Float ? Float : Int;
+					break;
+				case Select:
+					m_types[i] = m_types[children[1]] == Float || m_types[children[2]] == Float ? Float : Int;
+					break;
+				default:
+					m_types[i] = Int;
+					break;
+				}
+			}
+
+			// Lane index of every needed node within the lanes of its type
+			m_lanes.assign(m_root + 1, 0);
+			uint32_t numInts = 0;
+			uint32_t numFloats = 0;
+			for (uint32_t i = 0; i <= m_root; i++)
+			{
+				if(m_needed[i])
+				{
+					m_order.push_back(i);
+					m_lanes[i] = m_types[i] == Int ? numInts++ : numFloats++;
+				}
+			}
+			m_ints.resize((size_t)numInts * batch_size);
+			m_floats.resize((size_t)numFloats * batch_size);
+			m_swap = m_table.needsByteswap();
+			return true;
+		}
+
+		Result run(uint32_t first, uint32_t size)
+		{
+			const std::vector<NodeData>& nodes = m_expression.m_nodes;
+			for (Node i : m_order)
+			{
+				evaluateNode(i, nodes[i], first, size);
+			}
+
+			Result result;
+			result.first = first;
+			result.size = size;
+			result.type = m_types[m_root];
+			result.ints = result.type == Int ? ints(m_root) : nullptr;
+			result.floats = result.type == Float ? floats(m_root) : nullptr;
+			result.validity = nullptr;
+			if(!m_nullable.empty())
+			{
+				BTableBitmap::fill(m_validity, size, true);
+				for (const typename Table::FieldListEntry* field : m_nullable)
+				{
+					BTableBitmap::bitwiseAnd(m_validity, m_validity, m_table.getValidityBitmap(field) + first / 8, size);
+				}
+				result.validity = m_validity;
+			}
+			return result;
+		}
+
+	private:
+		int64_t* ints(Node node)
+		{
+			return m_ints.data() + (size_t)m_lanes[node] * batch_size;
+		}
+
+		double* floats(Node node)
+		{
+			return m_floats.data() + (size_t)m_lanes[node] * batch_size;
+		}
+
+		// Calls f with typed lane pointers of the given nodes
+		template <typename F>
+		void dispatch(Node a, F&& f)
+		{
+			if(m_types[a] == Int)
+			{
+				f(ints(a));
+			}
+			else
+			{
+				f(floats(a));
+			}
+		}
+
+		template <typename F>
+		void dispatch(Node a, Node b, F&& f)
+		{
+			dispatch(a, [&](auto* x)
+			{
+				dispatch(b, [&](auto* y)
+				{
+					f(x, y);
+				});
+			});
+		}
+
+		template <typename R, typename A, typename B>
+		static void arithmetic(Op op, const A* a, const B* b, R* out, uint32_t n)
+		{
+			if constexpr (std::is_integral<R>::value)
+			{
+				// Integer lanes wrap around like uint64 instead of overflowing (undefined).
+				// INT64_MIN / -1 is computed as a negation for the same reason
+				switch (op)
+				{
+				case Add: for (uint32_t i = 0; i < n; i++) out[i] = (R)((uint64_t)a[i] + (uint64_t)b[i]); break;
+				case Sub: for (uint32_t i = 0; i < n; i++) out[i] = (R)((uint64_t)a[i] - (uint64_t)b[i]); break;
+				case Mul: for (uint32_t i = 0; i < n; i++) out[i] = (R)((uint64_t)a[i] * (uint64_t)b[i]); break;
+				case Div: for (uint32_t i = 0; i < n; i++) out[i] = b[i] == 0 ? 0 : b[i] == -1 ? (R)(0 - (uint64_t)a[i]) : (R)(a[i] / b[i]); break;
+				default: break;
+				}
+			}
+			else
+			{
+				switch (op)
+				{
+				case Add: for (uint32_t i = 0; i < n; i++) out[i] = (R)a[i] + (R)b[i]; break;
+				case Sub: for (uint32_t i = 0; i < n; i++) out[i] = (R)a[i] - (R)b[i]; break;
+				case Mul: for (uint32_t i = 0; i < n; i++) out[i] = (R)a[i] * (R)b[i]; break;
+				case Div: for (uint32_t i = 0; i < n; i++) out[i] = (R)a[i] / (R)b[i]; break;
+				default: break;
+				}
+			}
+		}
+
+		template <typename A, typename B>
+		static void compare(Op op, const A* a, const B* b, int64_t* out, uint32_t n)
+		{
+			switch (op)
+			{
+			case Less: for (uint32_t i = 0; i < n; i++) out[i] = a[i] < b[i]; break;
+			case LessEqual: for (uint32_t i = 0; i < n; i++) out[i] = a[i] <= b[i]; break;
+			case Greater: for (uint32_t i = 0; i < n; i++) out[i] = a[i] > b[i]; break;
+			case GreaterEqual: for (uint32_t i = 0; i < n; i++) out[i] = a[i] >= b[i]; break;
+			case Equal: for (uint32_t i = 0; i < n; i++) out[i] = a[i] == b[i]; break;
+			case NotEqual: for (uint32_t i = 0; i < n; i++) out[i] = a[i] != b[i]; break;
+			case And: for (uint32_t i = 0; i < n; i++) out[i] = (a[i] != 0) & (b[i] != 0); break;
+			case Or: for (uint32_t i = 0; i < n; i++) out[i] = (a[i] != 0) | (b[i] != 0); break;
+			default: break;
+			}
+		}
+
+		template <typename R>
+		void loadColumn(const typename Table::FieldListEntry* field, uint32_t first, uint32_t n, R* out)
+		{
+			uint32_t stride = Table::getBytesPerEntry(field);
+			const unsigned char* base = (const unsigned char*)m_table.getValuePtr(field, 0) + (size_t)first * stride;
+			switch (Table::getFieldDataType(field))
+			{
+			case Table::INT8: BTableExpression::loadColumn<Table, int8_t>(base, stride, m_swap, n, out); break;
+			case Table::INT16: BTableExpression::loadColumn<Table, int16_t>(base, stride, m_swap, n, out); break;
+			case Table::INT32: BTableExpression::loadColumn<Table, int32_t>(base, stride, m_swap, n, out); break;
+			case Table::INT64: BTableExpression::loadColumn<Table, int64_t>(base, stride, m_swap, n, out); break;
+			case Table::FLOAT32: BTableExpression::loadColumn<Table, float>(base, stride, m_swap, n, out); break;
+			case Table::FLOAT64: BTableExpression::loadColumn<Table, double>(base, stride, m_swap, n, out); break;
+			case Table::FLOAT16: loadConverted<Table>(base, stride, m_swap, n, out, Table::halfToFloat); break;
+			case Table::BFLOAT16: loadConverted<Table>(base, stride, m_swap, n, out, Table::bfloat16ToFloat); break;
+			case Table::UINT8: BTableExpression::loadColumn<Table, uint8_t>(base, stride, m_swap, n, out); break;
+			case Table::UINT16: BTableExpression::loadColumn<Table, uint16_t>(base, stride, m_swap, n, out); break;
+			case Table::UINT32: BTableExpression::loadColumn<Table, uint32_t>(base, stride, m_swap, n, out); break;
+			case Table::UINT64: BTableExpression::loadColumn<Table, uint64_t>(base, stride, m_swap, n, out); break;
+			case Table::BOOL:
+				for (uint32_t r = 0; r < n; r++)
+				{
+					out[r] = BTableBitmap::get(base, (first + r) * field->arraySize);
+				}
+				break;
+			default: break;
+			}
+		}
+
+		void evaluateNode(Node i, const NodeData& node, uint32_t first, uint32_t n)
+		{
+			const Node* children = node.children;
+			switch (node.op)
+			{
+			case Column:
+				if(m_types[i] == Int)
+				{
+					loadColumn(m_fields[i], first, n, ints(i));
+				}
+				else
+				{
+					loadColumn(m_fields[i], first, n, floats(i));
+				}
+				break;
+			case ConstantInt:
+				for (uint32_t r = 0; r < n; r++) ints(i)[r] = node.intValue;
+				break;
+			case ConstantFloat:
+				for (uint32_t r = 0; r < n; r++) floats(i)[r] = node.floatValue;
+				break;
+			case Add:
+			case Sub:
+			case Mul:
+			case Div:
+				dispatch(children[0], children[1], [&](auto* a, auto* b)
+				{
+					if(m_types[i] == Int)
+					{
+						arithmetic(node.op, a, b, ints(i), n);
+					}
+					else
+					{
+						arithmetic(node.op, a, b, floats(i), n);
+					}
+				});
+				break;
+			case Not:
+				dispatch(children[0], [&](auto* a)
+				{
+					int64_t* out = ints(i);
+					for (uint32_t r = 0; r < n; r++) out[r] = a[r] == 0;
+				});
+				break;
+			case CastInt:
+				dispatch(children[0], [&](auto* a)
+				{
+					int64_t* out = ints(i);
+					for (uint32_t r = 0; r < n; r++) out[r] = toInt64(a[r]);
+				});
+				break;
+			case CastFloat:
+				dispatch(children[0], [&](auto* a)
+				{
+					double* out = floats(i);
+					for (uint32_t r = 0; r < n; r++) out[r] = (double)a[r];
+				});
+				break;
+			case Select:
+				dispatch(children[1], children[2], [&](auto* a, auto* b)
+				{
+					dispatch(children[0], [&](auto* condition)
+					{
+						if(m_types[i] == Int)
+						{
+							int64_t* out = ints(i);
+							for (uint32_t r = 0; r < n; r++) out[r] = condition[r] != 0 ? (int64_t)a[r] : (int64_t)b[r];
+						}
+						else
+						{
+							double* out = floats(i);
+							for (uint32_t r = 0; r < n; r++) out[r] = condition[r] != 0 ? (double)a[r] : (double)b[r];
+						}
+					});
+				});
+				break;
+			default:
+				dispatch(children[0], children[1], [&](auto* a, auto* b)
+				{
+					compare(node.op, a, b, ints(i), n);
+				});
+				break;
+			}
+		}
+
+		const BTableExpression& m_expression;
+		const Table& m_table;
+		Node m_root;
+		bool m_swap = false;
+		std::vector<Type> m_types;
+		std::vector<bool> m_needed;
+		std::vector<const typename Table::FieldListEntry*> m_fields;
+		std::vector<const typename Table::FieldListEntry*> m_nullable;
+		std::vector<Node> m_order; // Needed nodes, children before parents
+		std::vector<uint32_t> m_lanes;
+		std::vector<int64_t> m_ints;
+		std::vector<double> m_floats;
+		uint8_t m_validity[batch_size / 8];
+	};
+
+	std::vector<NodeData> m_nodes;
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cinttypes>
+#include <chrono>
+#include <vector>
+
+// Default instrumentation policy of BTableGeneric. Every hook is an empty inline
+// function and `enabled` is false, so instrumented call sites compile away.
+struct BTableInstrumentation
+{
+	enum Operation : uint8_t
+	{
+		Validate = 0,
+		Scan,
+		NumOperations
+	};
+
+	static constexpr bool enabled = false;
+
+	void onFieldLookup() const {}
+	void onByteswap(uint32_t /*count*/) const {}
+	void onRead(uint32_t /*fieldIndex*/, uint32_t /*bytes*/) const {}
+	void beginOperation(Operation /*op*/) const {}
+	void endOperation(Operation /*op*/, uint64_t /*entries*/, uint64_t /*bytes*/) const {}
+};
+
+// Counts field lookups, byteswaps and bytes read per column, and measures the
+// time spent in validation and scans. Counters are per table and not thread safe.
+struct BTableCountingInstrumentation : public BTableInstrumentation
+{
+	struct OperationStats
+	{
+		uint64_t calls;
+		uint64_t nanoseconds;
+		uint64_t entries;
+		uint64_t bytes;
+	};
+
+	static constexpr bool enabled = true;
+
+	void onFieldLookup() const
+	{
+		m_fieldLookups++;
+	}
+
+	void onByteswap(uint32_t count) const
+	{
+		m_byteswaps += count;
+	}
+
+	void onRead(uint32_t fieldIndex, uint32_t bytes) const
+	{
+		if(fieldIndex >= m_bytesRead.size())
+		{
+			m_bytesRead.resize(fieldIndex + 1, 0);
+		}
+		m_bytesRead[fieldIndex] += bytes;
+	}
+
+	void beginOperation(Operation op) const
+	{
+		m_start[op] = std::chrono::steady_clock::now();
+	}
+
+	void endOperation(Operation op, uint64_t entries, uint64_t bytes) const
+	{
+		auto elapsed = std::chrono::steady_clock::now() - m_start[op];
+		OperationStats& stats = m_stats[op];
+		stats.calls++;
+		stats.nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+		stats.entries += entries;
+		stats.bytes += bytes;
+	}
+
+	uint64_t getFieldLookups() const
+	{
+		return m_fieldLookups;
+	}
+
+	uint64_t getByteswaps() const
+	{
+		return m_byteswaps;
+	}
+
+	uint64_t getBytesRead(uint32_t fieldIndex) const
+	{
+		return fieldIndex < m_bytesRead.size() ? m_bytesRead[fieldIndex] : 0;
+	}
+
+	const OperationStats& getStats(Operation op) const
+	{
+		return m_stats[op];
+	}
+
+	// Bytes per second, zero if the operation has not been timed yet
+	double getThroughput(Operation op) const
+	{
+		const OperationStats& stats = m_stats[op];
+		return stats.nanoseconds == 0 ? 0.0 : stats.bytes * 1e9 / stats.nanoseconds;
+	}
+
+	void reset()
+	{
+		m_fieldLookups = 0;
+		m_byteswaps = 0;
+		m_bytesRead.clear();
+		for (int i = 0; i < NumOperations; i++)
+		{
+			m_stats[i] = OperationStats{};
+		}
+	}
+
+private:
+	mutable uint64_t m_fieldLookups = 0;
+	mutable uint64_t m_byteswaps = 0;
+	mutable std::vector<uint64_t> m_bytesRead;
+	mutable OperationStats m_stats[NumOperations] = {};
+	mutable std::chrono::steady_clock::time_point m_start[NumOperations];
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "instrumentation.h"
+
+#include <cstring>
+
+#ifdef __linux__
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Counting instrumentation that additionally samples CPU cycles and cache misses
+// through perf_event_open around every timed operation. If the counters can not be
+// opened (no PMU, restricted perf_event_paranoid) only the software counters are kept.
+struct BTablePerfInstrumentation : public BTableCountingInstrumentation
+{
+	struct HardwareStats
+	{
+		uint64_t cycles;
+		uint64_t cacheMisses;
+	};
+
+	BTablePerfInstrumentation()
+	{
+		m_cyclesFd = openCounter(PERF_COUNT_HW_CPU_CYCLES, -1);
+		if(m_cyclesFd != -1)
+		{
+			m_cacheMissesFd = openCounter(PERF_COUNT_HW_CACHE_MISSES, m_cyclesFd);
+		}
+		if(m_cacheMissesFd == -1)
+		{
+			closeCounters();
+		}
+	}
+
+	BTablePerfInstrumentation(const BTablePerfInstrumentation&) = delete;
+	BTablePerfInstrumentation& operator=(const BTablePerfInstrumentation&) = delete;
+
+	~BTablePerfInstrumentation()
+	{
+		closeCounters();
+	}
+
+	bool available() const
+	{
+		return m_cyclesFd != -1;
+	}
+
+	void beginOperation(Operation op) const
+	{
+		readCounters(m_begin[op]);
+		BTableCountingInstrumentation::beginOperation(op);
+	}
+
+	void endOperation(Operation op, uint64_t entries, uint64_t bytes) const
+	{
+		BTableCountingInstrumentation::endOperation(op, entries, bytes);
+		HardwareStats end;
+		readCounters(end);
+		m_hardware[op].cycles += end.cycles - m_begin[op].cycles;
+		m_hardware[op].cacheMisses += end.cacheMisses - m_begin[op].cacheMisses;
+	}
+
+	const HardwareStats& getHardwareStats(Operation op) const
+	{
+		return m_hardware[op];
+	}
+
+	// Average cycles per operation call, zero if unavailable
+	double getCyclesPerCall(Operation op) const
+	{
+		uint64_t calls = getStats(op).calls;
+		return calls == 0 ? 0.0 : (double)m_hardware[op].cycles / calls;
+	}
+
+	void reset()
+	{
+		BTableCountingInstrumentation::reset();
+		for (int i = 0; i < NumOperations; i++)
+		{
+			m_hardware[i] = HardwareStats{};
+		}
+	}
+
+private:
+	static int openCounter(uint64_t config, int groupFd)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = config;
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.disabled = groupFd == -1 ? 1 : 0;
+		int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+		if(fd != -1 && groupFd == -1)
+		{
+			ioctl(fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		}
+		return fd;
+	}
+
+	void closeCounters()
+	{
+		if(m_cacheMissesFd != -1)
+		{
+			close(m_cacheMissesFd);
+			m_cacheMissesFd = -1;
+		}
+		if(m_cyclesFd != -1)
+		{
+			close(m_cyclesFd);
+			m_cyclesFd = -1;
+		}
+	}
+
+	void readCounters(HardwareStats& stats) const
+	{
+		// PERF_FORMAT_GROUP layout: nr, then one value per counter in group order
+		uint64_t values[3] = {};
+		if(m_cyclesFd == -1 || read(m_cyclesFd, values, sizeof(values)) != sizeof(values))
+		{
+			stats = HardwareStats{};
+			return;
+		}
+		stats.cycles = values[1];
+		stats.cacheMisses = values[2];
+	}
+
+	int m_cyclesFd = -1;
+	int m_cacheMissesFd = -1;
+	mutable HardwareStats m_begin[NumOperations] = {};
+	mutable HardwareStats m_hardware[NumOperations] = {};
+};
+
+#endif
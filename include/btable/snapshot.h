@@ -0,0 +1,200 @@
+#pragma once
+
+#include "btable.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+// Table with lock-free readers and serialized writers. Two copies of the table are kept:
+// readers pin the published copy with a Snapshot, a writer applies its update to the
+// other copy, publishes it atomically, waits until no snapshot of the old copy is left
+// (grace period) and then replays the update on the old copy. A Snapshot always sees
+// one consistent version; writers pay for each update twice but never copy the table.
+// update() blocks until old snapshots are gone, so one long-lived Snapshot stalls every
+// writer, and a thread calling update() while holding a Snapshot deadlocks itself.
+// tryUpdate() bounds the wait: if snapshots outlive the timeout, the replay on the old copy
+// is deferred and the next update resyncs that copy by copying the current one.
+class BTableVersioned
+{
+public:
+	// Pins one version of the table until destroyed. Long-lived snapshots delay writers
+	class Snapshot
+	{
+	public:
+		Snapshot(Snapshot&& other) noexcept : m_table(other.m_table), m_readers(other.m_readers), m_version(other.m_version)
+		{
+			other.m_readers = nullptr;
+		}
+
+		Snapshot(const Snapshot&) = delete;
+		Snapshot& operator=(const Snapshot&) = delete;
+		Snapshot& operator=(Snapshot&&) = delete;
+
+		~Snapshot()
+		{
+			if(m_readers)
+			{
+				m_readers->fetch_sub(1, std::memory_order_release);
+			}
+		}
+
+		const BTableReadOnly& table() const
+		{
+			return *m_table;
+		}
+
+		const BTableReadOnly* operator->() const
+		{
+			return m_table;
+		}
+
+		uint64_t getVersion() const
+		{
+			return m_version;
+		}
+
+	private:
+		friend class BTableVersioned;
+
+		Snapshot(const BTableReadOnly* table, std::atomic<uint32_t>* readers, uint64_t version) : m_table(table), m_readers(readers), m_version(version)
+		{
+
+		}
+
+		const BTableReadOnly* m_table;
+		std::atomic<uint32_t>* m_readers;
+		uint64_t m_version;
+	};
+
+	// primary holds a valid table, secondary is overwritten with a copy of it.
+	// Both buffers must be size bytes and outlive this object
+	BTableVersioned(unsigned char* primary, unsigned char* secondary, uint32_t size) :
+		m_tables{ BTable(primary, size), BTable(secondary, size) },
+		m_views{ BTableReadOnly(primary, size), BTableReadOnly(secondary, size) },
+		m_buffers{ primary, secondary },
+		m_size(size)
+	{
+		memcpy(secondary, primary, size);
+	}
+
+	BTableVersioned(const BTableVersioned&) = delete;
+	BTableVersioned& operator=(const BTableVersioned&) = delete;
+
+	Snapshot read() const
+	{
+		uint32_t versionIndex = m_versionIndex.load();
+		m_readers[versionIndex].fetch_add(1);
+		uint32_t current = m_current.load();
+		return Snapshot(&m_views[current], &m_readers[versionIndex], m_copyVersions[current]);
+	}
+
+	// Calls mutation(BTable&) on both copies, so it has to be deterministic and must only
+	// depend on the table contents and its captures. Returns the published version
+	template <typename F>
+	uint64_t update(F&& mutation)
+	{
+		return apply(mutation, std::chrono::steady_clock::time_point::max());
+	}
+
+	// Like update(), waiting at most timeout for old snapshots. Returns 0 without calling
+	// mutation if a deferred resync is still blocked by snapshots. Otherwise the update is
+	// published; if the grace period times out, the old copy is resynced by the next update
+	template <typename F, typename Rep, typename Period>
+	uint64_t tryUpdate(F&& mutation, std::chrono::duration<Rep, Period> timeout)
+	{
+		return apply(mutation, std::chrono::steady_clock::now() + timeout);
+	}
+
+	uint64_t getVersion() const
+	{
+		return read().getVersion();
+	}
+
+private:
+	template <typename F>
+	uint64_t apply(F& mutation, std::chrono::steady_clock::time_point deadline)
+	{
+		std::lock_guard<std::mutex> lock(m_writerMutex);
+
+		uint32_t current = m_current.load();
+		if(m_stale)
+		{
+			if(!finishGracePeriod(deadline))
+			{
+				return 0;
+			}
+			memcpy(m_buffers[current ^ 1], m_buffers[current], m_size);
+			m_copyVersions[current ^ 1] = m_copyVersions[current];
+			m_stale = false;
+		}
+
+		uint64_t version = m_copyVersions[current] + 1;
+		mutation(m_tables[current ^ 1]);
+		m_copyVersions[current ^ 1] = version;
+
+		// Publish, new snapshots now see the updated copy
+		m_current.store(current ^ 1);
+		m_graceStep = 1;
+
+		if(!finishGracePeriod(deadline))
+		{
+			m_stale = true;
+			return version;
+		}
+		mutation(m_tables[current]);
+		m_copyVersions[current] = version;
+		return version;
+	}
+
+	// Grace period: drains snapshots that may still read the unpublished copy. Resumable,
+	// m_graceStep is 1 before and 2 after flipping the version index
+	bool finishGracePeriod(std::chrono::steady_clock::time_point deadline)
+	{
+		if(m_graceStep == 1)
+		{
+			uint32_t versionIndex = m_versionIndex.load();
+			if(!waitForReaders(versionIndex ^ 1, deadline))
+			{
+				return false;
+			}
+			m_versionIndex.store(versionIndex ^ 1);
+			m_graceStep = 2;
+		}
+		if(m_graceStep == 2)
+		{
+			if(!waitForReaders(m_versionIndex.load() ^ 1, deadline))
+			{
+				return false;
+			}
+			m_graceStep = 0;
+		}
+		return true;
+	}
+
+	bool waitForReaders(uint32_t versionIndex, std::chrono::steady_clock::time_point deadline) const
+	{
+		while(m_readers[versionIndex].load() != 0)
+		{
+			if(deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= deadline)
+			{
+				return false;
+			}
+			std::this_thread::yield();
+		}
+		return true;
+	}
+
+	BTable m_tables[2];
+	BTableReadOnly m_views[2];
+	unsigned char* m_buffers[2];
+	uint32_t m_size;
+	uint64_t m_copyVersions[2] = {}; // Only written while no reader can see the copy
+	uint32_t m_graceStep = 0; // Writer only, see finishGracePeriod()
+	bool m_stale = false; // The unpublished copy misses the last update
+	std::atomic<uint32_t> m_current{ 0 };
+	std::atomic<uint32_t> m_versionIndex{ 0 };
+	mutable std::atomic<uint32_t> m_readers[2] = {};
+	std::mutex m_writerMutex;
+};
@@ -1,6 +1,17 @@
+#include "btable/appender.h"
+#include "btable/arrow.h"
 #include "btable/btable.h"
+#include "btable/diff.h"
+#include "btable/expression.h"
+#include "btable/perf_counters.h"
+#include "btable/snapshot.h"
 #include <gtest/gtest.h>
 
+#include <cmath>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
 TEST(BTableTest, Hash)
 {
 	EXPECT_EQ(BTable::hash("Value"), 0xA151);
@@ -512,3 +523,1712 @@ TEST(BTableTest, UserData)
 	EXPECT_EQ(userData[0], 50);
 	EXPECT_EQ(userData[1], 100);
 }
+
+TEST(BTableTest, InstrumentationDefaultIsEmpty)
+{
+	// Same members as BTableGeneric without a policy base
+	struct Uninstrumented
+	{
+		unsigned char* bufferPtr;
+		uint32_t m_size;
+	};
+	static_assert(std::is_empty<BTableInstrumentation>::value, "default policy must be empty");
+	EXPECT_EQ(sizeof(BTable), sizeof(Uninstrumented));
+	EXPECT_EQ(sizeof(BTableReadOnly), sizeof(Uninstrumented));
+	EXPECT_GT(sizeof(BTableInstrumented<BTableCountingInstrumentation>), sizeof(Uninstrumented));
+	EXPECT_FALSE(BTableInstrumentation::enabled);
+}
+
+TEST(BTableTest, InstrumentationCounting)
+{
+	typedef BTableInstrumented<BTableCountingInstrumentation> CountingTable;
+	uint8_t buffer[128];
+	CountingTable::FieldData fields[2];
+
+	fields[0].name = "a";
+	fields[0].arraySize = 1;
+	fields[0].dataType = CountingTable::DataType::INT8;
+	fields[1].name = "b";
+	fields[1].arraySize = 1;
+	fields[1].dataType = CountingTable::DataType::INT8;
+
+	CountingTable t(buffer, 128);
+	t.init(fields, 2, 4);
+	const auto& counters = t.getInstrumentation();
+
+	const auto* field = t.getField("b");
+	EXPECT_EQ(counters.getFieldLookups(), 1);
+
+	uint64_t byteswaps = counters.getByteswaps();
+	t.getValueInt8(field, 0);
+	t.getValueInt8(field, 1);
+	EXPECT_EQ(counters.getBytesRead(0), 0);
+	EXPECT_EQ(counters.getBytesRead(1), 2);
+	EXPECT_EQ(counters.getByteswaps() - byteswaps, BTable::is_little_endian_cpu ? 4 : 0);
+
+	EXPECT_TRUE(t.validate());
+	EXPECT_EQ(counters.getStats(BTableInstrumentation::Validate).calls, 1);
+
+	uint32_t visited = 0;
+	t.forEachEntry(field, [&](const void*, uint32_t) { visited++; });
+	EXPECT_EQ(visited, 4);
+	EXPECT_EQ(counters.getStats(BTableInstrumentation::Scan).entries, 4);
+	EXPECT_EQ(counters.getStats(BTableInstrumentation::Scan).bytes, 4);
+	EXPECT_EQ(counters.getBytesRead(1), 6);
+
+	t.getInstrumentation().reset();
+	EXPECT_EQ(counters.getFieldLookups(), 0);
+	EXPECT_EQ(counters.getBytesRead(1), 0);
+}
+
+TEST(BTableTest, InstrumentationCountsValueByteswaps)
+{
+	typedef BTableInstrumented<BTableCountingInstrumentation> CountingTable;
+	CountingTable::FieldData field;
+	field.name = "a";
+	field.arraySize = 1;
+	field.dataType = CountingTable::DataType::INT32;
+
+	// Header fields are swapped the same way in both tables, only data values differ
+	enum CountingTable::Endianness native = CountingTable::is_little_endian_cpu ? CountingTable::Little : CountingTable::Big;
+	enum CountingTable::Endianness foreign = CountingTable::is_little_endian_cpu ? CountingTable::Big : CountingTable::Little;
+	uint64_t swaps[2];
+	enum CountingTable::Endianness endianness[2] = { native, foreign };
+	for (int i = 0; i < 2; i++)
+	{
+		uint8_t buffer[128];
+		CountingTable t(buffer, 128);
+		t.init(&field, 1, 4, 1, endianness[i]);
+		t.getInstrumentation().reset();
+		const auto* a = t.getField("a");
+		for (uint32_t entry = 0; entry < 4; entry++)
+		{
+			t.setValue<int32_t>(a, entry, (int32_t)entry);
+		}
+		EXPECT_EQ(t.getValue<int32_t>(a, 3), 3);
+		EXPECT_EQ(t.sumValues<int32_t>(a), 6);
+		swaps[i] = t.getInstrumentation().getByteswaps();
+	}
+	EXPECT_EQ(swaps[1] - swaps[0], 4u + 1 + 4);
+}
+
+#ifdef __linux__
+TEST(BTableTest, InstrumentationPerfCounters)
+{
+	typedef BTableInstrumented<BTablePerfInstrumentation> PerfTable;
+	uint8_t buffer[128];
+	PerfTable::FieldData fields[1];
+
+	fields[0].name = "a";
+	fields[0].arraySize = 1;
+	fields[0].dataType = PerfTable::DataType::INT8;
+
+	PerfTable t(buffer, 128);
+	t.init(fields, 1, 8);
+	EXPECT_TRUE(t.validate());
+
+	// Hardware counters may be unavailable in containers, the software counters are not
+	const auto& counters = t.getInstrumentation();
+	EXPECT_EQ(counters.getStats(BTableInstrumentation::Validate).calls, 1);
+	if(!counters.available())
+	{
+		EXPECT_EQ(counters.getHardwareStats(BTableInstrumentation::Validate).cycles, 0);
+	}
+}
+#endif
+
+TEST(BTableTest, CalculateBufferSizeNullable)
+{
+	BTable::FieldData fields[2];
+
+	fields[0].dataType = BTable::INT8;
+	fields[0].arraySize = 1;
+	fields[0].nullable = true;
+	fields[1].dataType = BTable::INT32;
+	fields[1].arraySize = 1;
+
+	// 3 values padded to 8, one bitmap word, then 3 INT32 values
+	EXPECT_EQ(BTable::calculateBufferSize(fields, 2, 3), 16 + BTable::field_entry_size * 2 + 8 + 8 + 12);
+	// 65 entries need two bitmap words
+	EXPECT_EQ(BTable::calculateBufferSize(fields, 1, 65), 16 + BTable::field_entry_size + 72 + 16);
+}
+
+TEST(BTableTest, ValidityBitmap)
+{
+	uint8_t buffer[128];
+	BTable::FieldData fields[2];
+
+	fields[0].name = "a";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT8;
+	fields[0].nullable = true;
+	fields[1].name = "b";
+	fields[1].arraySize = 1;
+	fields[1].dataType = BTable::DataType::INT8;
+
+	BTable t(buffer, 128);
+	t.init(fields, 2, 3);
+	ASSERT_TRUE(t.validate());
+
+	const auto* a = t.getField("a");
+	const auto* b = t.getField("b");
+	EXPECT_TRUE(BTable::isNullable(a));
+	EXPECT_FALSE(BTable::isNullable(b));
+	EXPECT_EQ(BTable::getFieldDataType(a), BTable::INT8);
+	EXPECT_EQ(*(uint8_t*)(buffer + 22), BTable::INT8 | BTable::field_flag_nullable);
+
+	// Column b starts after the padded values and the bitmap of a
+	EXPECT_EQ(t.getValidityBitmap(a), buffer + 32 + 8);
+	EXPECT_EQ(t.getValidityBitmap(b), nullptr);
+	EXPECT_EQ(BTable::be32_to_cpu(b->offset), 16);
+
+	EXPECT_FALSE(t.isValid(a, 0));
+	EXPECT_TRUE(t.isValid(b, 0));
+
+	t.setValueInt8(a, 1, 42);
+	EXPECT_TRUE(t.isValid(a, 1));
+	EXPECT_EQ(t.getNullableValue<int8_t>(a, 1), 42);
+	EXPECT_FALSE(t.getNullableValue<int8_t>(a, 0).has_value());
+
+	t.setNull(a, 1);
+	EXPECT_FALSE(t.isValid(a, 1));
+	EXPECT_EQ(t.countValid(a), 0);
+
+	// Bulk writes are clamped to the column and mark the written entries valid
+	int8_t values[] = { 7, 8, 9 };
+	t.setEntries(a, 1, values, 3);
+	EXPECT_FALSE(t.isValid(a, 0));
+	EXPECT_EQ(t.getNullableValue<int8_t>(a, 1), 7);
+	EXPECT_EQ(t.getNullableValue<int8_t>(a, 2), 8);
+	EXPECT_EQ(t.countValid(a), 2);
+}
+
+TEST(BTableTest, ValidityBitmapValidate)
+{
+	uint8_t buffer[128];
+	BTable::FieldData fields[1];
+
+	fields[0].name = "a";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT8;
+	fields[0].nullable = true;
+
+	uint32_t size = BTable::calculateBufferSize(fields, 1, 3);
+	BTable(buffer, size).init(fields, 1, 3);
+	EXPECT_TRUE(BTable(buffer, size).validate());
+	EXPECT_FALSE(BTable(buffer, size - 1).validate());
+}
+
+TEST(BTableTest, BitmapOperations)
+{
+	uint8_t a[16] = {};
+	uint8_t b[16] = {};
+	uint8_t dst[16];
+
+	BTableBitmap::fill(a, 100, true);
+	BTableBitmap::set(b, 3, true);
+	BTableBitmap::set(b, 70, true);
+	BTableBitmap::set(b, 99, true);
+	EXPECT_EQ(BTableBitmap::count(a, 100), 100);
+	EXPECT_EQ(BTableBitmap::count(b, 100), 3);
+
+	BTableBitmap::bitwiseAnd(dst, a, b, 100);
+	EXPECT_EQ(BTableBitmap::count(dst, 100), 3);
+	EXPECT_TRUE(BTableBitmap::get(dst, 70));
+
+	BTableBitmap::bitwiseAndNot(dst, a, b, 100);
+	EXPECT_EQ(BTableBitmap::count(dst, 100), 97);
+	EXPECT_FALSE(BTableBitmap::get(dst, 99));
+
+	BTableBitmap::bitwiseOr(dst, b, b, 100);
+	EXPECT_EQ(BTableBitmap::count(dst, 100), 3);
+
+	BTableBitmap::fill(dst, 100, false);
+	BTableBitmap::fillRange(dst, 5, 83, true);
+	EXPECT_EQ(BTableBitmap::count(dst, 100), 78);
+	EXPECT_FALSE(BTableBitmap::get(dst, 4));
+	EXPECT_TRUE(BTableBitmap::get(dst, 5));
+	EXPECT_TRUE(BTableBitmap::get(dst, 82));
+	EXPECT_FALSE(BTableBitmap::get(dst, 83));
+	BTableBitmap::fillRange(dst, 2, 6, false);
+	EXPECT_EQ(BTableBitmap::count(dst, 100), 77);
+}
+
+TEST(BTableTest, SumValuesWithValidityAndSelection)
+{
+	const uint32_t numEntries = 130;
+	BTable::FieldData fields[1];
+
+	fields[0].name = "v";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT32;
+	fields[0].nullable = true;
+
+	uint8_t buffer[1024];
+	BTable t(buffer, BTable::calculateBufferSize(fields, 1, numEntries));
+	t.init(fields, 1, numEntries);
+	const auto* v = t.getField("v");
+
+	for (uint32_t i = 0; i < numEntries; i++)
+	{
+		if(i % 10 != 0)
+		{
+			t.setValue<int32_t>(v, i, (int32_t)i);
+		}
+	}
+	EXPECT_EQ(t.getValue<int32_t>(v, 129), 129);
+
+	uint32_t count = 0;
+	int64_t expected = 0;
+	for (uint32_t i = 0; i < numEntries; i++)
+	{
+		expected += i % 10 != 0 ? i : 0;
+	}
+	EXPECT_EQ((t.sumValues<int32_t, int64_t>(v, nullptr, &count)), expected);
+	EXPECT_EQ(count, 117);
+	EXPECT_EQ(t.countValid(v), 117);
+
+	std::vector<uint8_t> selection(BTableBitmap::getSize(numEntries));
+	BTableBitmap::set(selection.data(), 10, true);
+	BTableBitmap::set(selection.data(), 11, true);
+	BTableBitmap::set(selection.data(), 128, true);
+	EXPECT_EQ((t.sumValues<int32_t, int64_t>(v, selection.data(), &count)), 11 + 128);
+	EXPECT_EQ(count, 2);
+	EXPECT_EQ(t.countValid(v, selection.data()), 2);
+
+	std::vector<uint8_t> combined(BTableBitmap::getSize(numEntries));
+	t.selectValid(v, selection.data(), combined.data());
+	EXPECT_EQ(BTableBitmap::count(combined.data(), numEntries), 2);
+
+	// Array columns are rejected instead of summing only their first elements
+	fields[0].arraySize = 2;
+	ASSERT_TRUE(t.init(fields, 1, 4));
+	t.setValue<int32_t>(t.getField("v"), 1, 5, 1);
+	count = 1;
+	EXPECT_EQ((t.sumValues<int32_t, int64_t>(t.getField("v"), nullptr, &count)), 0);
+	EXPECT_EQ(count, 0);
+}
+
+TEST(BTableTest, CalculateBufferSizeList)
+{
+	BTable::FieldData fields[1];
+
+	fields[0].dataType = BTable::INT16;
+	fields[0].arraySize = 1;
+	fields[0].list = true;
+	fields[0].listCapacity = 5;
+
+	// Capacity and 4 offsets padded to 24 bytes, then 5 INT16 values
+	EXPECT_EQ(BTable::calculateBufferSize(fields, 1, 3), 16 + BTable::field_entry_size + 24 + 10);
+}
+
+TEST(BTableTest, ListColumn)
+{
+	uint8_t buffer[256];
+	BTable::FieldData fields[2];
+
+	fields[0].name = "list";
+	fields[0].arraySize = 0;
+	fields[0].dataType = BTable::DataType::INT32;
+	fields[0].list = true;
+	fields[0].listCapacity = 6;
+	fields[1].name = "value";
+	fields[1].arraySize = 1;
+	fields[1].dataType = BTable::DataType::INT8;
+
+	uint32_t size = BTable::calculateBufferSize(fields, 2, 3);
+	ASSERT_LE(size, 256);
+	BTable t(buffer, size);
+	t.init(fields, 2, 3);
+	ASSERT_TRUE(t.validate());
+
+	const auto* list = t.getField("list");
+	EXPECT_TRUE(BTable::isList(list));
+	EXPECT_EQ(t.getListCapacity(list), 6);
+	EXPECT_EQ(t.getListSize(list, 0), 0);
+
+	int32_t first[] = { 1, 2, 3 };
+	int32_t third[] = { 4, 5 };
+	EXPECT_TRUE(t.setListValues<int32_t>(list, 0, first, 3));
+	EXPECT_TRUE(t.setListValues<int32_t>(list, 1, nullptr, 0));
+	EXPECT_FALSE(t.setListValues<int32_t>(list, 2, first, 4));
+	EXPECT_TRUE(t.setListValues<int32_t>(list, 2, third, 2));
+	EXPECT_TRUE(t.validate());
+
+	EXPECT_EQ(t.getListSize(list, 0), 3);
+	EXPECT_EQ(t.getListSize(list, 1), 0);
+	EXPECT_EQ(t.getListSize(list, 2), 2);
+
+	uint32_t count;
+	t.getListValues(list, &count);
+	EXPECT_EQ(count, 5);
+	EXPECT_EQ((t.sumListValues<int32_t, int64_t>(list)), 15);
+	EXPECT_EQ((t.sumValues<int32_t, int64_t>(list, nullptr, &count)), 0);
+	EXPECT_EQ(count, 0);
+	EXPECT_FALSE(t.forEachEntry(list, [](const void*, uint32_t) {}));
+	EXPECT_TRUE(t.forEachEntry(t.getField("value"), [](const void*, uint32_t) {}));
+
+	uint32_t n;
+	const void* values = t.getList(list, 2, &n);
+	EXPECT_EQ(n, 2);
+	EXPECT_EQ(BTable::loadValue<int32_t>(values, t.needsByteswap()), 4);
+
+	// The column after the list is laid out behind the flat values
+	t.setValueInt8(t.getField("value"), 2, 7);
+	EXPECT_EQ(t.getValueInt8(t.getField("value"), 2), 7);
+	EXPECT_EQ(t.getListSize(list, 2), 2);
+}
+
+TEST(BTableTest, ListColumnValidateOffsets)
+{
+	uint8_t buffer[256];
+	BTable::FieldData fields[1];
+
+	fields[0].name = "list";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT8;
+	fields[0].list = true;
+	fields[0].listCapacity = 4;
+
+	uint32_t size = BTable::calculateBufferSize(fields, 1, 3);
+	BTable t(buffer, size);
+	t.init(fields, 1, 3);
+	int8_t values[] = { 1, 2, 3 };
+	ASSERT_TRUE(t.setList(t.getField("list"), 0, values, 3));
+
+	// Entry 1 has not been written yet, so its end offset is below its start
+	EXPECT_FALSE(t.validate());
+	ASSERT_TRUE(t.setList(t.getField("list"), 1, values, 1));
+	ASSERT_TRUE(t.setList(t.getField("list"), 2, nullptr, 0));
+	EXPECT_TRUE(t.validate());
+	EXPECT_EQ(t.getListView<int8_t>(t.getField("list"), 1)[0], 1);
+}
+
+TEST(BTableTest, ListColumnAppendsInOrder)
+{
+	uint8_t buffer[256];
+	BTable::FieldData fields[1];
+
+	fields[0].name = "list";
+	fields[0].dataType = BTable::DataType::INT16;
+	fields[0].list = true;
+	fields[0].listCapacity = 8;
+
+	BTable t(buffer, BTable::calculateBufferSize(fields, 1, 4));
+	ASSERT_TRUE(t.init(fields, 1, 4));
+	const auto* list = t.getField("list");
+	int16_t values[] = { 1, 2, 3 };
+
+	ASSERT_TRUE(t.setListValues<int16_t>(list, 0, values, 2));
+	// Skipping an entry, rewriting a written one and writing past the end are rejected
+	EXPECT_FALSE(t.setListValues<int16_t>(list, 2, values, 1));
+	EXPECT_FALSE(t.setListValues<int16_t>(list, 0, values, 3));
+	EXPECT_FALSE(t.setListValues<int16_t>(list, 4, values, 1));
+	ASSERT_TRUE(t.setListValues<int16_t>(list, 1, values, 3));
+	EXPECT_FALSE(t.setList(list, 1, values, 1));
+	ASSERT_TRUE(t.setListValues<int16_t>(list, 2, nullptr, 0));
+	ASSERT_TRUE(t.setListValues<int16_t>(list, 3, values + 2, 1));
+	EXPECT_FALSE(t.setListValues<int16_t>(list, 3, values, 1));
+	ASSERT_TRUE(t.validate());
+
+	EXPECT_EQ(t.getListSize(list, 0), 2);
+	EXPECT_EQ(t.getListSize(list, 1), 3);
+	EXPECT_EQ(t.getListSize(list, 2), 0);
+	ASSERT_EQ(t.getListSize(list, 3), 1);
+	EXPECT_EQ((t.sumListValues<int16_t, int32_t>(list)), 1 + 2 + 1 + 2 + 3 + 3);
+}
+
+TEST(BTableTest, CalculateBufferSizeAligned)
+{
+	BTable::FieldData fields[2];
+
+	fields[0].dataType = BTable::INT8;
+	fields[0].arraySize = 1;
+	fields[1].dataType = BTable::INT64;
+	fields[1].arraySize = 1;
+
+	// Data section at 64, INT8 column 0..3, INT64 column at 64..88, rounded up to 64
+	EXPECT_EQ(BTable::calculateBufferSize(fields, 2, 3, 64), 64 + 128);
+	EXPECT_EQ(BTable::calculateBufferSize(fields, 2, 3, 1), BTable::calculateBufferSize(fields, 2, 3));
+	EXPECT_EQ(BTable::calculateBufferSize(fields, 2, 3, 48), 0);
+	EXPECT_EQ(BTable::calculateBufferSize(fields, 2, 3, 0), 0);
+}
+
+TEST(BTableTest, AlignedColumns)
+{
+	alignas(64) uint8_t buffer[512];
+	BTable::FieldData fields[3];
+
+	fields[0].name = "a";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT8;
+	fields[1].name = "b";
+	fields[1].arraySize = 1;
+	fields[1].dataType = BTable::DataType::INT64;
+	fields[2].name = "c";
+	fields[2].dataType = BTable::DataType::INT32;
+	fields[2].list = true;
+	fields[2].listCapacity = 4;
+
+	uint32_t size = BTable::calculateBufferSize(fields, 3, 5, 64);
+	ASSERT_LE(size, 512);
+	BTable t(buffer, size);
+	EXPECT_FALSE(t.init(fields, 3, 5, 3));
+	ASSERT_TRUE(t.init(fields, 3, 5, 64));
+	ASSERT_TRUE(t.validate());
+
+	EXPECT_EQ(t.getColumnAlignment(), 64);
+	EXPECT_TRUE(t.isBufferAligned());
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		EXPECT_EQ((uintptr_t)t.getEntries(t.getField(i)) % 64, 0);
+	}
+	EXPECT_EQ((uintptr_t)t.getListValues(t.getField("c")) % 64, 0);
+
+	// Misaligned column offset is rejected
+	uint32_t offset = BTable::be32_to_cpu(t.getField("b")->offset);
+	t.getFieldList()[1].offset = BTable::cpu_to_be32(offset + 8);
+	EXPECT_FALSE(t.validate());
+}
+
+TEST(BTableTest, PackedColumnAlignment)
+{
+	uint8_t buffer[128];
+	BTable::FieldData fields[1];
+
+	fields[0].name = "";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT8;
+
+	BTable t(buffer, 128);
+	t.init(fields, 1, 1);
+	EXPECT_EQ(t.getColumnAlignment(), 1);
+	EXPECT_EQ(buffer[12], 0);
+}
+
+TEST(BTableTest, ValidateRejectsForgedNumEntries)
+{
+	uint8_t buffer[64];
+	BTable::FieldData fields[2];
+	fields[0].name = "a";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT64;
+	fields[1].name = "b";
+	fields[1].arraySize = 1;
+	fields[1].dataType = BTable::DataType::INT64;
+	fields[1].nullable = true;
+
+	BTable t(buffer, 64);
+	ASSERT_TRUE(t.init(fields, 1, 2));
+	ASSERT_TRUE(t.validate());
+
+	// 2^29 INT64 values are 2^32 bytes, which wraps to 0 in 32 bit arithmetic
+	t.getHeader()->numEntries = BTable::cpu_to_be32(1u << 29);
+	EXPECT_FALSE(t.validate());
+	t.getHeader()->numEntries = BTable::cpu_to_be32(0xFFFFFFFF);
+	EXPECT_FALSE(t.validate());
+
+	std::vector<unsigned char> nullable(BTable::calculateBufferSize(fields, 2, 2));
+	BTable n(nullable.data(), (uint32_t)nullable.size());
+	ASSERT_TRUE(n.init(fields, 2, 2));
+	ASSERT_TRUE(n.validate());
+	n.getHeader()->numEntries = BTable::cpu_to_be32(1u << 29);
+	EXPECT_FALSE(n.validate());
+}
+
+TEST(BTableTest, InitRejectsUndersizedBuffer)
+{
+	BTable::FieldData fields[2];
+	fields[0].name = "a";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT32;
+	fields[0].nullable = true;
+	fields[1].name = "b";
+	fields[1].dataType = BTable::DataType::INT16;
+	fields[1].list = true;
+	fields[1].listCapacity = 8;
+
+	// The validity bitmap and list header must not be cleared past the end of the buffer
+	std::vector<uint8_t> buffer(128, 0xAB);
+	BTable t(buffer.data(), 64);
+	EXPECT_FALSE(t.init(fields, 1, 1000));
+	EXPECT_FALSE(t.init(fields + 1, 1, 1000));
+	for (uint8_t byte : buffer)
+	{
+		ASSERT_EQ(byte, 0xAB);
+	}
+
+	uint32_t size = BTable::calculateBufferSize(fields, 2, 1000);
+	std::vector<uint8_t> exact(size);
+	BTable e(exact.data(), size - 1);
+	EXPECT_FALSE(e.init(fields, 2, 1000));
+	BTable f(exact.data(), size);
+	ASSERT_TRUE(f.init(fields, 2, 1000));
+	EXPECT_TRUE(f.validate());
+}
+
+TEST(BTableTest, LayoutMustFit32Bit)
+{
+	BTable::FieldData fields[2];
+	fields[0].name = "a";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT64;
+	fields[1].name = "b";
+	fields[1].arraySize = 1;
+	fields[1].dataType = BTable::DataType::INT8;
+
+	// Column a ends at 2^32 + 16, which would place b inside a in 32 bit arithmetic
+	uint32_t numEntries = (1u << 29) + 2;
+	EXPECT_EQ(BTable::calculateBufferSize(fields, 2, numEntries), 0);
+	EXPECT_EQ(BTable::calculateBufferSize(fields, 1, numEntries), 0);
+	uint8_t buffer[64];
+	BTable t(buffer, 64);
+	EXPECT_FALSE(t.init(fields, 2, numEntries));
+
+	// Columns that each fit but together end past 4 GiB
+	fields[0].dataType = BTable::DataType::INT32;
+	fields[1].dataType = BTable::DataType::INT32;
+	EXPECT_EQ(BTable::calculateBufferSize(fields, 2, 1u << 29), 0);
+	EXPECT_GT(BTable::calculateBufferSize(fields, 1, 1u << 29), 0);
+}
+
+TEST(BTableTest, DataOffsetMustFitHeader)
+{
+	std::vector<BTable::FieldData> fields(4100);
+	for (auto& field : fields)
+	{
+		field.name = "f";
+		field.arraySize = 1;
+		field.dataType = BTable::DataType::INT8;
+	}
+
+	// 4100 field entries end below 64 KiB, aligned to 32 KiB the data would start at 64 KiB
+	EXPECT_EQ(BTable::calculateBufferSize(fields.data(), 4100, 1, 32768), 0);
+	EXPECT_GT(BTable::calculateBufferSize(fields.data(), 4100, 1, 16384), 0);
+	uint8_t small[64];
+	BTable t(small, 64);
+	EXPECT_FALSE(t.init(fields.data(), 4100, 1, 32768));
+
+	// A data section overlapping the field list is rejected
+	uint8_t buffer[128];
+	BTable valid(buffer, 128);
+	ASSERT_TRUE(valid.init(fields.data(), 2, 4));
+	ASSERT_TRUE(valid.validate());
+	valid.getHeader()->dataOffset = 0;
+	EXPECT_FALSE(valid.validate());
+}
+
+TEST(BTableTest, VersionedSnapshotsAreConsistent)
+{
+	const uint32_t numEntries = 64;
+	BTable::FieldData fields[2];
+
+	fields[0].name = "a";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT32;
+	fields[1].name = "b";
+	fields[1].arraySize = 1;
+	fields[1].dataType = BTable::DataType::INT32;
+
+	uint32_t size = BTable::calculateBufferSize(fields, 2, numEntries);
+	std::vector<unsigned char> primary(size), secondary(size);
+	BTable(primary.data(), size).init(fields, 2, numEntries);
+
+	BTableVersioned versioned(primary.data(), secondary.data(), size);
+	EXPECT_EQ(versioned.getVersion(), 0);
+
+	std::atomic<bool> done{ false };
+	std::atomic<uint32_t> inconsistent{ 0 };
+	std::vector<std::thread> readers;
+	for (int r = 0; r < 4; r++)
+	{
+		readers.emplace_back([&]()
+		{
+			uint64_t lastVersion = 0;
+			while(!done.load())
+			{
+				auto snapshot = versioned.read();
+				const auto* a = snapshot->getField("a");
+				const auto* b = snapshot->getField("b");
+				int32_t expected = snapshot->getValue<int32_t>(a, 0);
+				for (uint32_t i = 0; i < numEntries; i++)
+				{
+					if(snapshot->getValue<int32_t>(a, i) != expected || snapshot->getValue<int32_t>(b, i) != expected)
+					{
+						inconsistent++;
+					}
+				}
+				if(snapshot.getVersion() < lastVersion || expected != (int32_t)snapshot.getVersion())
+				{
+					inconsistent++;
+				}
+				lastVersion = snapshot.getVersion();
+			}
+		});
+	}
+
+	for (int32_t v = 1; v <= 200; v++)
+	{
+		uint64_t version = versioned.update([v](BTable& t)
+		{
+			for (uint32_t i = 0; i < numEntries; i++)
+			{
+				t.setValue<int32_t>(t.getField("a"), i, v);
+				t.setValue<int32_t>(t.getField("b"), i, v);
+			}
+		});
+		EXPECT_EQ(version, (uint64_t)v);
+	}
+	done.store(true);
+	for (auto& reader : readers)
+	{
+		reader.join();
+	}
+
+	EXPECT_EQ(inconsistent.load(), 0);
+	EXPECT_EQ(versioned.getVersion(), 200);
+	auto snapshot = versioned.read();
+	EXPECT_EQ(snapshot->getValue<int32_t>(snapshot->getField("b"), numEntries - 1), 200);
+}
+
+TEST(BTableTest, VersionedTryUpdateDefersReplay)
+{
+	BTable::FieldData field;
+	field.name = "a";
+	field.arraySize = 1;
+	field.dataType = BTable::DataType::INT32;
+
+	uint32_t size = BTable::calculateBufferSize(&field, 1, 4);
+	std::vector<unsigned char> primary(size), secondary(size);
+	BTable(primary.data(), size).init(&field, 1, 4);
+	BTableVersioned versioned(primary.data(), secondary.data(), size);
+	auto add = [](int32_t n)
+	{
+		return [n](BTable& t)
+		{
+			t.setValue<int32_t>(t.getField("a"), 0, t.getValue<int32_t>(t.getField("a"), 0) + n);
+		};
+	};
+
+	{
+		// update() would wait for this thread's own snapshot forever
+		auto snapshot = versioned.read();
+		EXPECT_EQ(versioned.tryUpdate(add(1), std::chrono::milliseconds(1)), 1u);
+		EXPECT_EQ(snapshot.getVersion(), 0u);
+		EXPECT_EQ(snapshot->getValue<int32_t>(snapshot->getField("a"), 0), 0);
+		EXPECT_EQ(versioned.read()->getValue<int32_t>(versioned.read()->getField("a"), 0), 1);
+
+		// The old copy cannot be resynced while the snapshot pins it
+		EXPECT_EQ(versioned.tryUpdate(add(10), std::chrono::milliseconds(1)), 0u);
+	}
+
+	EXPECT_EQ(versioned.update(add(2)), 2u);
+	EXPECT_EQ(versioned.update(add(4)), 3u);
+	EXPECT_EQ(versioned.update(add(8)), 4u);
+	auto snapshot = versioned.read();
+	EXPECT_EQ(snapshot.getVersion(), 4u);
+	EXPECT_EQ(snapshot->getValue<int32_t>(snapshot->getField("a"), 0), 15);
+	EXPECT_EQ(primary, secondary);
+}
+
+TEST(BTableTest, AppenderConcurrentProducers)
+{
+	const uint32_t capacity = 20000;
+	BTable::FieldData fields[2];
+
+	fields[0].name = "id";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT32;
+	fields[1].name = "tag";
+	fields[1].arraySize = 1;
+	fields[1].dataType = BTable::DataType::INT8;
+
+	uint32_t size = BTable::calculateBufferSize(fields, 2, capacity);
+	std::vector<unsigned char> buffer(size);
+	BTable t(buffer.data(), size);
+	t.init(fields, 2, capacity);
+
+	BTableAppender appender(t);
+	const auto* id = t.getField("id");
+	const auto* tag = t.getField("tag");
+
+	std::vector<std::thread> producers;
+	for (int p = 0; p < 8; p++)
+	{
+		producers.emplace_back([&, p]()
+		{
+			for (uint32_t batch = 0; batch < 100; batch++)
+			{
+				uint32_t n = 1 + (p * 7 + batch) % 23;
+				uint32_t first = appender.reserve(n);
+				if(first == (uint32_t)-1)
+				{
+					return;
+				}
+				int32_t* ids = (int32_t*)appender.getColumn(id, first);
+				int8_t* tags = (int8_t*)appender.getColumn(tag, first);
+				for (uint32_t i = 0; i < n; i++)
+				{
+					BTable::storeValue<int32_t>(ids + i, (int32_t)(first + i), t.needsByteswap());
+					tags[i] = (int8_t)p;
+				}
+				appender.publish(first, n);
+			}
+		});
+	}
+	for (auto& producer : producers)
+	{
+		producer.join();
+	}
+
+	uint32_t published = appender.getPublishedEntries();
+	EXPECT_EQ(published, appender.getReservedEntries());
+	EXPECT_GT(published, 0);
+	for (uint32_t i = 0; i < published; i++)
+	{
+		ASSERT_EQ(t.getValue<int32_t>(id, i), (int32_t)i);
+	}
+
+	EXPECT_TRUE(appender.finish());
+	EXPECT_EQ(t.getNumEntries(), published);
+	EXPECT_TRUE(t.validate());
+}
+
+TEST(BTableTest, AppenderWatermark)
+{
+	const uint32_t capacity = BTableAppender::block_size * 2 + 10;
+	BTable::FieldData fields[1];
+
+	fields[0].name = "v";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT8;
+
+	uint32_t size = BTable::calculateBufferSize(fields, 1, capacity);
+	std::vector<unsigned char> buffer(size);
+	BTable t(buffer.data(), size);
+	t.init(fields, 1, capacity);
+	BTableAppender appender(t);
+
+	uint32_t first = appender.reserve(BTableAppender::block_size);
+	uint32_t second = appender.reserve(BTableAppender::block_size + 5);
+	EXPECT_EQ(appender.reserve(10), (uint32_t)-1);
+
+	EXPECT_TRUE(appender.publish(second, BTableAppender::block_size + 5));
+	EXPECT_EQ(appender.getPublishedEntries(), 0);
+	EXPECT_FALSE(appender.finish());
+
+	// Unreserved ranges and a second publish of the same range are rejected
+	EXPECT_FALSE(appender.publish(second, BTableAppender::block_size + 6));
+	EXPECT_FALSE(appender.publish(capacity, 1));
+	EXPECT_FALSE(appender.publish(0xFFFFFFFF, 2));
+	EXPECT_FALSE(appender.publish(second, BTableAppender::block_size + 5));
+	EXPECT_EQ(appender.getPublishedEntries(), 0);
+
+	EXPECT_TRUE(appender.publish(first, BTableAppender::block_size));
+	EXPECT_EQ(appender.getPublishedEntries(), BTableAppender::block_size * 2 + 5);
+	EXPECT_TRUE(appender.finish());
+	EXPECT_FALSE(appender.publish(first, 1));
+}
+
+TEST(BTableTest, AppenderRejectsUnsupportedColumns)
+{
+	BTable::FieldData fields[2];
+	fields[0].name = "v";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT32;
+	fields[1].name = "flag";
+	fields[1].arraySize = 1;
+	fields[1].dataType = BTable::DataType::BOOL;
+
+	uint32_t size = BTable::calculateBufferSize(fields, 2, 100);
+	std::vector<unsigned char> buffer(size);
+	BTable t(buffer.data(), size);
+	t.init(fields, 2, 100);
+	EXPECT_FALSE(BTableAppender::supports(t));
+	EXPECT_TRUE(BTableAppender::supports(t.getField("v")));
+
+	BTableAppender appender(t);
+	EXPECT_EQ(appender.getCapacity(), 0);
+	EXPECT_EQ(appender.reserve(1), (uint32_t)-1);
+	EXPECT_EQ(appender.getColumn(t.getField("flag"), 0), nullptr);
+}
+
+static void initArrowTestTable(BTable& t, uint32_t numEntries)
+{
+	const auto* a = t.getField("a");
+	const auto* b = t.getField("b");
+	const auto* c = t.getField("c");
+	for (uint32_t i = 0; i < numEntries; i++)
+	{
+		if(i % 3 != 1)
+		{
+			t.setValue<int32_t>(a, i, (int32_t)i * 10);
+		}
+		for (uint32_t j = 0; j < 3; j++)
+		{
+			t.setValue<int16_t>(b, i, (int16_t)(i + j), j);
+		}
+		int64_t list[2] = { (int64_t)i, -(int64_t)i };
+		t.setListValues<int64_t>(c, i, list, i % 3);
+	}
+}
+
+static void setArrowTestFields(BTable::FieldData* fields, uint32_t numEntries)
+{
+	fields[0].name = "a";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT32;
+	fields[0].nullable = true;
+	fields[1].name = "b";
+	fields[1].arraySize = 3;
+	fields[1].dataType = BTable::DataType::INT16;
+	fields[2].name = "c";
+	fields[2].dataType = BTable::DataType::INT64;
+	fields[2].list = true;
+	fields[2].listCapacity = numEntries * 2;
+}
+
+TEST(BTableTest, ArrowExportZeroCopy)
+{
+	const uint32_t numEntries = 10;
+	BTable::FieldData fields[3];
+	setArrowTestFields(fields, numEntries);
+
+	alignas(64) uint8_t buffer[1024];
+	uint32_t size = BTable::calculateBufferSize(fields, 3, numEntries, 8);
+	ASSERT_LE(size, 1024);
+	BTable t(buffer, size);
+	t.init(fields, 3, numEntries, 8, BTable::is_little_endian_cpu ? BTable::Little : BTable::Big);
+	initArrowTestTable(t, numEntries);
+	ASSERT_FALSE(t.needsByteswap());
+
+	ArrowSchema schema;
+	ArrowArray array;
+	const auto* a = t.getField("a");
+	ASSERT_TRUE(BTableArrow::exportColumn(t, a, &schema, &array, "a"));
+	EXPECT_STREQ(schema.format, "i");
+	EXPECT_STREQ(schema.name, "a");
+	EXPECT_EQ(schema.flags, ARROW_FLAG_NULLABLE);
+	EXPECT_EQ(array.length, numEntries);
+	EXPECT_EQ(array.null_count, 3);
+	EXPECT_EQ(array.buffers[0], t.getValidityBitmap(a));
+	EXPECT_EQ(array.buffers[1], t.getEntries(a));
+	EXPECT_EQ(((const int32_t*)array.buffers[1])[9], 90);
+	schema.release(&schema);
+	array.release(&array);
+	EXPECT_EQ(schema.release, nullptr);
+
+	const auto* c = t.getField("c");
+	ASSERT_TRUE(BTableArrow::exportColumn(t, c, &schema, &array));
+	EXPECT_STREQ(schema.format, "+l");
+	ASSERT_EQ(schema.n_children, 1);
+	EXPECT_STREQ(schema.children[0]->format, "l");
+	EXPECT_EQ(array.children[0]->buffers[1], t.getListValues(c));
+	EXPECT_EQ(((const int32_t*)array.buffers[1])[numEntries], 9);
+	schema.release(&schema);
+	array.release(&array);
+}
+
+TEST(BTableTest, ArrowRoundTrip)
+{
+	const uint32_t numEntries = 10;
+	BTable::FieldData fields[3];
+	setArrowTestFields(fields, numEntries);
+
+	// Big endian source forces converted copies on little endian CPUs
+	std::vector<unsigned char> source(BTable::calculateBufferSize(fields, 3, numEntries));
+	BTable t(source.data(), (uint32_t)source.size());
+	t.init(fields, 3, numEntries, 1, BTable::Big);
+	initArrowTestTable(t, numEntries);
+
+	ArrowSchema schema;
+	ArrowArray array;
+	const char* names[] = { "a", "b", "c" };
+	ASSERT_TRUE(BTableArrow::exportTable(t, &schema, &array, names));
+	EXPECT_STREQ(schema.format, "+s");
+	ASSERT_EQ(schema.n_children, 3);
+	EXPECT_STREQ(schema.children[1]->format, "+w:3");
+
+	BTable::FieldData imported[3];
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		ASSERT_TRUE(BTableArrow::getFieldData<BTable>(schema.children[i], array.children[i], &imported[i]));
+	}
+	EXPECT_TRUE(imported[0].nullable);
+	EXPECT_EQ(imported[1].arraySize, 3);
+	EXPECT_TRUE(imported[2].list);
+	EXPECT_EQ(imported[2].listCapacity, 9);
+
+	std::vector<unsigned char> target(BTable::calculateBufferSize(imported, 3, numEntries));
+	BTable u(target.data(), (uint32_t)target.size());
+	u.init(imported, 3, numEntries, 1, BTable::Little);
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		ASSERT_TRUE(BTableArrow::importColumn(u, u.getField(i), schema.children[i], array.children[i]));
+	}
+	schema.release(&schema);
+	array.release(&array);
+
+	ASSERT_TRUE(u.validate());
+	for (uint32_t i = 0; i < numEntries; i++)
+	{
+		EXPECT_EQ(u.getNullableValue<int32_t>(u.getField("a"), i), t.getNullableValue<int32_t>(t.getField("a"), i));
+		EXPECT_EQ(u.getValue<int16_t>(u.getField("b"), i, 2), (int16_t)(i + 2));
+		ASSERT_EQ(u.getListSize(u.getField("c"), i), i % 3);
+		if(i % 3 == 2)
+		{
+			EXPECT_EQ(u.getListView<int64_t>(u.getField("c"), i)[1], -(int64_t)i);
+		}
+	}
+}
+
+TEST(BTableTest, ArrowImportRejectsMismatch)
+{
+	uint8_t buffer[128];
+	BTable::FieldData fields[1];
+
+	fields[0].name = "a";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT32;
+
+	BTable t(buffer, 128);
+	t.init(fields, 1, 4);
+
+	ArrowSchema schema;
+	ArrowArray array;
+	ASSERT_TRUE(BTableArrow::exportColumn(t, t.getField("a"), &schema, &array));
+
+	BTable::FieldData other[1];
+	other[0].name = "a";
+	other[0].arraySize = 1;
+	other[0].dataType = BTable::DataType::INT64;
+	uint8_t otherBuffer[128];
+	BTable u(otherBuffer, 128);
+	u.init(other, 1, 4);
+	EXPECT_FALSE(BTableArrow::importColumn(u, u.getField("a"), &schema, &array));
+
+	u.init(fields, 1, 3);
+	EXPECT_FALSE(BTableArrow::importColumn(u, u.getField("a"), &schema, &array));
+
+	schema.release(&schema);
+	array.release(&array);
+}
+
+TEST(BTableTest, ArrowImportRejectsMalformedList)
+{
+	BTable::FieldData fields[1];
+	fields[0].name = "a";
+	fields[0].dataType = BTable::DataType::INT32;
+	fields[0].list = true;
+	fields[0].listCapacity = 4;
+
+	std::vector<unsigned char> buffer(BTable::calculateBufferSize(fields, 1, 2));
+	BTable t(buffer.data(), (uint32_t)buffer.size());
+
+	int32_t values[4] = { 1, 2, 3, 4 };
+	int32_t offsets[3];
+	const void* childBuffers[2] = { nullptr, values };
+	ArrowArray child = {};
+	child.length = 4;
+	child.n_buffers = 2;
+	child.buffers = childBuffers;
+	ArrowArray* children[1] = { &child };
+	const void* listBuffers[2] = { nullptr, offsets };
+	ArrowArray list = {};
+	list.length = 2;
+	list.n_buffers = 2;
+	list.buffers = listBuffers;
+	list.n_children = 1;
+	list.children = children;
+
+	ArrowSchema childSchema = {};
+	childSchema.format = "i";
+	ArrowSchema* schemaChildren[1] = { &childSchema };
+	ArrowSchema schema = {};
+	schema.format = "+l";
+	schema.n_children = 1;
+	schema.children = schemaChildren;
+
+	// Negative, descending and out of bounds offsets
+	const int32_t malformed[3][3] = { { -1, 1, 2 }, { 0, 3, 2 }, { 0, 2, 5 } };
+	for (const auto& m : malformed)
+	{
+		memcpy(offsets, m, sizeof(offsets));
+		ASSERT_TRUE(t.init(fields, 1, 2));
+		EXPECT_FALSE(BTableArrow::importColumn(t, t.getField("a"), &schema, &list));
+	}
+
+	const int32_t valid[3] = { 0, 1, 4 };
+	memcpy(offsets, valid, sizeof(offsets));
+	ASSERT_TRUE(t.init(fields, 1, 2));
+	ASSERT_TRUE(BTableArrow::importColumn(t, t.getField("a"), &schema, &list));
+	EXPECT_EQ(t.getListSize(t.getField("a"), 1), 3);
+
+	BTable::FieldData field;
+	child.length = -1;
+	EXPECT_FALSE(BTableArrow::getFieldData<BTable>(&schema, &list, &field));
+	child.length = (int64_t)UINT32_MAX + 1;
+	EXPECT_FALSE(BTableArrow::getFieldData<BTable>(&schema, &list, &field));
+
+	// Fixed size list widths must be a plain number
+	schema.format = "+w:4x";
+	EXPECT_FALSE(BTableArrow::getFieldData<BTable>(&schema, &list, &field));
+	schema.format = "+w:4";
+	EXPECT_TRUE(BTableArrow::getFieldData<BTable>(&schema, &list, &field));
+	EXPECT_EQ(field.arraySize, 4);
+}
+
+TEST(BTableTest, BatchIteration)
+{
+	const uint32_t numEntries = 1000;
+	BTable::FieldData fields[2];
+
+	fields[0].name = "a";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT32;
+	fields[1].name = "b";
+	fields[1].arraySize = 2;
+	fields[1].dataType = BTable::DataType::INT8;
+	fields[1].nullable = true;
+
+	std::vector<unsigned char> buffer(BTable::calculateBufferSize(fields, 2, numEntries));
+	BTable t(buffer.data(), (uint32_t)buffer.size());
+	t.init(fields, 2, numEntries, 1, BTable::is_little_endian_cpu ? BTable::Little : BTable::Big);
+	const auto* a = t.getField("a");
+	const auto* b = t.getField("b");
+	for (uint32_t i = 0; i < numEntries; i++)
+	{
+		t.setValue<int32_t>(a, i, (int32_t)i);
+		if(i % 2 == 0)
+		{
+			t.setValue<int8_t>(b, i, 1, 1);
+		}
+	}
+
+	uint32_t numBatches = 0;
+	uint32_t rows = 0;
+	int64_t sum = 0;
+	uint32_t valid = 0;
+	for (auto batch : t.batches({ a, b }, 256))
+	{
+		EXPECT_EQ(batch.getFirstEntry(), rows);
+		const int32_t* values = batch.column<int32_t>(0);
+		const int8_t* pairs = batch.column<int8_t>(1);
+		for (uint32_t i = 0; i < batch.size(); i++)
+		{
+			sum += values[i];
+			valid += batch.isValid(1, i) ? pairs[i * 2 + 1] : 0;
+		}
+		rows += batch.size();
+		numBatches++;
+	}
+	EXPECT_EQ(numBatches, 4);
+	EXPECT_EQ(rows, numEntries);
+	EXPECT_EQ(sum, (int64_t)numEntries * (numEntries - 1) / 2);
+	EXPECT_EQ(valid, numEntries / 2);
+
+	auto range = t.batches({ a }, 600);
+	auto it = range.begin();
+	EXPECT_EQ((*it).size(), 600);
+	it++;
+	EXPECT_EQ((*it).size(), 400);
+	EXPECT_EQ(++it, range.end());
+	EXPECT_EQ(std::distance(range.begin(), range.end()), 2);
+}
+
+TEST(BTableTest, TypedAccessRequiresNativeByteOrder)
+{
+	BTable::FieldData fields[3];
+	fields[0].name = "a";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT32;
+	fields[1].name = "b";
+	fields[1].arraySize = 1;
+	fields[1].dataType = BTable::DataType::INT8;
+	fields[2].name = "c";
+	fields[2].dataType = BTable::DataType::INT32;
+	fields[2].list = true;
+	fields[2].listCapacity = 4;
+
+	// Default byte order, swapped on little-endian CPUs
+	std::vector<unsigned char> buffer(BTable::calculateBufferSize(fields, 3, 10));
+	BTable t(buffer.data(), (uint32_t)buffer.size());
+	t.init(fields, 3, 10);
+	for (uint32_t i = 0; i < 10; i++)
+	{
+		t.setValue<int32_t>(t.getField("a"), i, (int32_t)i);
+		t.setValue<int8_t>(t.getField("b"), i, (int8_t)i);
+		int32_t list[1] = { (int32_t)i };
+		t.setListValues<int32_t>(t.getField("c"), i, list, i == 3 ? 1 : 0);
+	}
+
+	for (auto batch : t.batches({ t.getField("a"), t.getField("b") }))
+	{
+		EXPECT_EQ(batch.column<int32_t>(0) == nullptr, t.needsByteswap());
+		ASSERT_NE(batch.column<int8_t>(1), nullptr);
+		EXPECT_EQ(batch.column<int8_t>(1)[7], 7);
+		EXPECT_EQ(BTable::loadValue<int32_t>((const int32_t*)batch.columnData(0) + 7, t.needsByteswap()), 7);
+	}
+
+	// List columns have no fixed size values, in either byte order
+	std::vector<unsigned char> little(buffer.size());
+	BTable l(little.data(), (uint32_t)little.size());
+	ASSERT_TRUE(l.init(fields, 3, 10, 1, BTable::Little));
+	for (BTable* table : { &t, &l })
+	{
+		for (auto batch : table->batches({ table->getField("c"), table->getField("a") }))
+		{
+			EXPECT_EQ(batch.column<int32_t>(0), nullptr);
+			EXPECT_EQ(batch.columnData(0), nullptr);
+			EXPECT_NE(batch.columnData(1), nullptr);
+		}
+	}
+
+	BTable::ListView<int32_t> view = t.getListView<int32_t>(t.getField("c"), 3);
+	if(t.needsByteswap())
+	{
+		EXPECT_EQ(view.data, nullptr);
+		EXPECT_EQ(view.size, 0);
+	}
+	else
+	{
+		ASSERT_EQ(view.size, 1);
+		EXPECT_EQ(view[0], 3);
+	}
+}
+
+TEST(BTableTest, ExpressionDerivedColumn)
+{
+	const uint32_t numEntries = 3000;
+	BTable::FieldData fields[4];
+
+	fields[0].name = "price";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::FLOAT64;
+	fields[1].name = "qty";
+	fields[1].arraySize = 1;
+	fields[1].dataType = BTable::DataType::INT16;
+	fields[1].nullable = true;
+	fields[2].name = "total";
+	fields[2].arraySize = 1;
+	fields[2].dataType = BTable::DataType::FLOAT32;
+	fields[2].nullable = true;
+	fields[3].name = "bucket";
+	fields[3].arraySize = 1;
+	fields[3].dataType = BTable::DataType::INT8;
+
+	std::vector<unsigned char> buffer(BTable::calculateBufferSize(fields, 4, numEntries));
+	BTable t(buffer.data(), (uint32_t)buffer.size());
+	t.init(fields, 4, numEntries);
+	for (uint32_t i = 0; i < numEntries; i++)
+	{
+		t.setValue<double>(t.getField("price"), i, 0.5 * (i % 8));
+		if(i % 100 != 0)
+		{
+			t.setValue<int16_t>(t.getField("qty"), i, (int16_t)(i % 10));
+		}
+	}
+
+	BTableExpression e;
+	BTableExpression::Node price = e.column(t.getFieldIndex("price"));
+	BTableExpression::Node qty = e.column(t.getFieldIndex("qty"));
+	BTableExpression::Node total = e.mul(price, qty);
+	ASSERT_TRUE(e.materialize(t, total, t.getField("total")));
+
+	for (uint32_t i = 0; i < numEntries; i++)
+	{
+		if(i % 100 == 0)
+		{
+			ASSERT_FALSE(t.isValid(t.getField("total"), i));
+			continue;
+		}
+		ASSERT_FLOAT_EQ(t.getValue<float>(t.getField("total"), i), (float)(0.5 * (i % 8) * (i % 10)));
+	}
+
+	// Bucketing: qty >= 5 ? 1 : 0, then integer division and casts
+	BTableExpression::Node bucket = e.select(e.greaterEqual(qty, e.constant((int64_t)5)), e.constant((int64_t)1), e.constant((int64_t)0));
+	ASSERT_TRUE(e.materialize(t, bucket, t.getField("bucket")));
+	EXPECT_EQ(t.getValue<int8_t>(t.getField("bucket"), 7), 1);
+	EXPECT_EQ(t.getValue<int8_t>(t.getField("bucket"), 4), 0);
+
+	int64_t quotient;
+	BTableExpression::Node halves = e.div(e.castInt(e.mul(price, e.constant(2.0))), e.sub(qty, qty));
+	ASSERT_TRUE(e.sum(t, halves, &quotient));
+	EXPECT_EQ(quotient, 0);
+
+	// An early node of a builder reused for several expressions only gets lanes of its own type
+	ASSERT_TRUE(e.evaluate(t, qty, [&](const BTableExpression::Result& result)
+	{
+		EXPECT_EQ(result.type, BTableExpression::Int);
+		EXPECT_EQ(result.floats, nullptr);
+		EXPECT_EQ(result.ints[7], (int64_t)((result.first + 7) % 10));
+	}));
+}
+
+TEST(BTableTest, ExpressionFilterAndSum)
+{
+	const uint32_t numEntries = 2500;
+	BTable::FieldData fields[2];
+
+	fields[0].name = "a";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT32;
+	fields[1].name = "b";
+	fields[1].arraySize = 1;
+	fields[1].dataType = BTable::DataType::FLOAT32;
+	fields[1].nullable = true;
+
+	std::vector<unsigned char> buffer(BTable::calculateBufferSize(fields, 2, numEntries));
+	BTable t(buffer.data(), (uint32_t)buffer.size());
+	t.init(fields, 2, numEntries);
+	for (uint32_t i = 0; i < numEntries; i++)
+	{
+		t.setValue<int32_t>(t.getField("a"), i, (int32_t)i);
+		if(i % 2 == 0)
+		{
+			t.setValue<float>(t.getField("b"), i, 1.5f);
+		}
+	}
+
+	BTableExpression e;
+	BTableExpression::Node a = e.column(0);
+	BTableExpression::Node b = e.column(1);
+	BTableExpression::Node predicate = e.logicalAnd(e.less(a, e.constant((int64_t)2000)), e.greater(b, e.constant(1.0)));
+
+	std::vector<uint8_t> selection(BTableBitmap::getSize(numEntries));
+	ASSERT_TRUE(e.filter(t, predicate, selection.data()));
+	EXPECT_EQ(BTableBitmap::count(selection.data(), numEntries), 1000);
+	EXPECT_FALSE(BTableBitmap::get(selection.data(), 1));
+	EXPECT_TRUE(BTableBitmap::get(selection.data(), 1998));
+	EXPECT_FALSE(BTableBitmap::get(selection.data(), 2000));
+
+	int64_t sum;
+	uint32_t count;
+	ASSERT_TRUE(e.sum(t, a, &sum, selection.data(), &count));
+	EXPECT_EQ(count, 1000);
+	EXPECT_EQ(sum, 999 * 1000);
+
+	double weighted;
+	ASSERT_TRUE(e.sum(t, e.mul(a, b), &weighted));
+	EXPECT_DOUBLE_EQ(weighted, 1.5 * 1250 * 2498 / 2);
+
+	EXPECT_FALSE(e.sum(t, e.column(5), &sum));
+}
+
+TEST(BTableTest, ExpressionIntegerOverflowWraps)
+{
+	BTable::FieldData fields[2];
+	fields[0].name = "a";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT64;
+	fields[1].name = "b";
+	fields[1].arraySize = 1;
+	fields[1].dataType = BTable::DataType::INT64;
+
+	std::vector<unsigned char> buffer(BTable::calculateBufferSize(fields, 2, 1));
+	BTable t(buffer.data(), (uint32_t)buffer.size());
+	t.init(fields, 2, 1);
+	t.setValue<int64_t>(t.getField("a"), 0, INT64_MIN);
+	t.setValue<int64_t>(t.getField("b"), 0, -1);
+
+	BTableExpression e;
+	BTableExpression::Node a = e.column(0);
+	BTableExpression::Node b = e.column(1);
+	int64_t result;
+	ASSERT_TRUE(e.sum(t, e.div(a, b), &result));
+	EXPECT_EQ(result, INT64_MIN);
+	ASSERT_TRUE(e.sum(t, e.add(a, b), &result));
+	EXPECT_EQ(result, INT64_MAX);
+	ASSERT_TRUE(e.sum(t, e.mul(a, b), &result));
+	EXPECT_EQ(result, INT64_MIN);
+	ASSERT_TRUE(e.sum(t, e.castInt(e.constant(1e300)), &result));
+	EXPECT_EQ(result, INT64_MAX);
+	ASSERT_TRUE(e.sum(t, e.castInt(e.constant((double)NAN)), &result));
+	EXPECT_EQ(result, 0);
+}
+
+TEST(BTableTest, GatherPreservesOrder)
+{
+	const uint32_t numEntries = 5000;
+	BTable::FieldData fields[2];
+	fields[0].name = "id";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT64;
+	fields[1].name = "tag";
+	fields[1].arraySize = 3;
+	fields[1].dataType = BTable::DataType::INT8;
+
+	std::vector<unsigned char> buffer(BTable::calculateBufferSize(fields, 2, numEntries));
+	BTable t(buffer.data(), (uint32_t)buffer.size());
+	t.init(fields, 2, numEntries);
+	for (uint32_t i = 0; i < numEntries; i++)
+	{
+		t.setValue<int64_t>(t.getField("id"), i, (int64_t)i * 3);
+		int8_t tag[3] = { (int8_t)i, (int8_t)(i + 1), (int8_t)(i + 2) };
+		t.setArrayInt8(t.getField("tag"), i, tag, 3);
+	}
+
+	std::vector<uint32_t> entries;
+	for (uint32_t i = 0; i < 3000; i++)
+	{
+		entries.push_back((i * 7919) % numEntries);
+	}
+
+	for (bool sortBatches : { false, true })
+	{
+		BTable::GatherOptions options;
+		options.sortBatches = sortBatches;
+		options.batchSize = 256;
+		std::vector<int64_t> ids(entries.size());
+		std::vector<uint8_t> tags(entries.size() * 3);
+		ASSERT_TRUE(t.gather({ t.getField("id"), t.getField("tag") }, entries.data(), (uint32_t)entries.size(), { ids.data(), tags.data() }, options));
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			EXPECT_EQ(BTable::loadValue<int64_t>((const unsigned char*)&ids[i], t.needsByteswap()), (int64_t)entries[i] * 3);
+			EXPECT_EQ(tags[i * 3 + 2], (uint8_t)(entries[i] + 2));
+		}
+	}
+
+	int64_t out;
+	uint32_t outOfRange = numEntries;
+	EXPECT_FALSE(t.gather({ t.getField("id") }, &outOfRange, 1, { &out }));
+}
+
+TEST(BTableTest, GatherCountsBytesRead)
+{
+	typedef BTableInstrumented<BTableCountingInstrumentation> CountingTable;
+	CountingTable::FieldData fields[2];
+	fields[0].name = "a";
+	fields[0].arraySize = 1;
+	fields[0].dataType = CountingTable::DataType::INT32;
+	fields[1].name = "b";
+	fields[1].arraySize = 2;
+	fields[1].dataType = CountingTable::DataType::INT16;
+
+	uint8_t buffer[256];
+	CountingTable t(buffer, 256);
+	ASSERT_TRUE(t.init(fields, 2, 8));
+	t.getInstrumentation().reset();
+
+	uint32_t entries[3] = { 5, 1, 7 };
+	int32_t a[3];
+	int16_t b[6];
+	CountingTable::GatherOptions options;
+	options.batchSize = 2;
+	ASSERT_TRUE(t.gather({ t.getField("a"), t.getField("b") }, entries, 3, { a, b }, options));
+	const auto& counters = t.getInstrumentation();
+	EXPECT_EQ(counters.getBytesRead(0), 12);
+	EXPECT_EQ(counters.getBytesRead(1), 12);
+	EXPECT_EQ(counters.getStats(BTableInstrumentation::Scan).bytes, 24);
+}
+
+TEST(BTableTest, DiffPatchChangedEntries)
+{
+	const uint32_t numEntries = 10000;
+	BTable::FieldData fields[2];
+	fields[0].name = "a";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT32;
+	fields[1].name = "b";
+	fields[1].arraySize = 1;
+	fields[1].dataType = BTable::DataType::FLOAT64;
+	fields[1].nullable = true;
+
+	uint32_t size = BTable::calculateBufferSize(fields, 2, numEntries);
+	std::vector<unsigned char> oldBuffer(size);
+	BTable oldTable(oldBuffer.data(), size);
+	oldTable.init(fields, 2, numEntries);
+	for (uint32_t i = 0; i < numEntries; i++)
+	{
+		oldTable.setValue<int32_t>(oldTable.getField("a"), i, (int32_t)i);
+	}
+
+	std::vector<unsigned char> newBuffer(oldBuffer);
+	BTable newTable(newBuffer.data(), size);
+	newTable.setValue<int32_t>(newTable.getField("a"), 17, -1);
+	newTable.setValue<int32_t>(newTable.getField("a"), 18, -2);
+	newTable.setValue<double>(newTable.getField("b"), 9000, 2.5);
+
+	std::vector<unsigned char> patch;
+	ASSERT_TRUE(BTableDiff::create(oldTable, newTable, patch));
+	// Entries 17-18 of a, entry 9000 of b and the validity word holding its bit
+	EXPECT_EQ(patch.size(), BTableDiff::header_size + 3 * (BTableDiff::range_header_size + 8));
+	EXPECT_EQ(BTableDiff::getNewSize(patch.data(), (uint32_t)patch.size()), size);
+
+	uint32_t newSize = 0;
+	EXPECT_FALSE(BTableDiff::apply(oldBuffer.data(), size - 1, size, patch.data(), (uint32_t)patch.size(), &newSize));
+	EXPECT_FALSE(BTableDiff::apply(oldBuffer.data(), size, size, patch.data(), (uint32_t)patch.size() - 1, &newSize));
+	ASSERT_TRUE(BTableDiff::apply(oldBuffer.data(), size, size, patch.data(), (uint32_t)patch.size(), &newSize));
+	EXPECT_EQ(newSize, size);
+	EXPECT_EQ(oldBuffer, newBuffer);
+
+	// Unchanged tables give an empty patch
+	ASSERT_TRUE(BTableDiff::create(oldTable, newTable, patch));
+	EXPECT_EQ(patch.size(), BTableDiff::header_size);
+}
+
+TEST(BTableTest, DiffPatchRejectsWrongBaseVersion)
+{
+	BTable::FieldData field;
+	field.name = "a";
+	field.arraySize = 1;
+	field.dataType = BTable::DataType::INT32;
+
+	uint32_t size = BTable::calculateBufferSize(&field, 1, 1000);
+	std::vector<unsigned char> versions[3];
+	for (int v = 0; v < 3; v++)
+	{
+		versions[v].resize(size);
+		BTable t(versions[v].data(), size);
+		t.init(&field, 1, 1000);
+		for (uint32_t i = 0; i < 1000; i++)
+		{
+			t.setValue<int32_t>(t.getField("a"), i, (int32_t)i + (i == 500 ? v : 0) + (i == 900 && v == 2 ? 1 : 0));
+		}
+	}
+
+	// Patch from version 2 to 3, the replica still holds version 1
+	std::vector<unsigned char> patch;
+	ASSERT_TRUE(BTableDiff::create(BTableReadOnly(versions[1].data(), size), BTableReadOnly(versions[2].data(), size), patch));
+	std::vector<unsigned char> replica(versions[0]);
+	uint32_t newSize = 0;
+	EXPECT_FALSE(BTableDiff::apply(replica.data(), size, size, patch.data(), (uint32_t)patch.size(), &newSize));
+	EXPECT_EQ(replica, versions[0]);
+
+	// A damaged patch fails the hash of the result
+	replica = versions[1];
+	std::vector<unsigned char> damaged(patch);
+	damaged.back() ^= 1;
+	EXPECT_FALSE(BTableDiff::apply(replica.data(), size, size, damaged.data(), (uint32_t)damaged.size(), &newSize));
+	EXPECT_EQ(replica, versions[1]);
+
+	ASSERT_TRUE(BTableDiff::apply(replica.data(), size, size, patch.data(), (uint32_t)patch.size(), &newSize));
+	EXPECT_EQ(replica, versions[2]);
+	EXPECT_EQ(BTableDiff::hash(replica.data(), size), BTableDiff::hash(versions[2].data(), size));
+}
+
+TEST(BTableTest, DiffPatchSchemaChange)
+{
+	BTable::FieldData fields[2];
+	fields[0].name = "a";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::INT32;
+	fields[1].name = "c";
+	fields[1].arraySize = 2;
+	fields[1].dataType = BTable::DataType::INT16;
+
+	uint32_t oldSize = BTable::calculateBufferSize(fields, 1, 100);
+	uint32_t newSize = BTable::calculateBufferSize(fields, 2, 150);
+	std::vector<unsigned char> oldBuffer(newSize);
+	BTable oldTable(oldBuffer.data(), oldSize);
+	oldTable.init(fields, 1, 100);
+	std::vector<unsigned char> newBuffer(newSize);
+	BTable newTable(newBuffer.data(), newSize);
+	newTable.init(fields, 2, 150);
+	for (uint32_t i = 0; i < 150; i++)
+	{
+		if(i < 100)
+		{
+			oldTable.setValue<int32_t>(oldTable.getField("a"), i, (int32_t)i);
+		}
+		newTable.setValue<int32_t>(newTable.getField("a"), i, (int32_t)i);
+		newTable.setValue<int16_t>(newTable.getField("c"), i, (int16_t)i, 1);
+	}
+
+	std::vector<unsigned char> patch;
+	ASSERT_TRUE(BTableDiff::create(oldTable, newTable, patch));
+	uint32_t patchedSize = 0;
+	EXPECT_FALSE(BTableDiff::apply(oldBuffer.data(), oldSize, newSize - 1, patch.data(), (uint32_t)patch.size(), &patchedSize));
+	ASSERT_TRUE(BTableDiff::apply(oldBuffer.data(), oldSize, newSize, patch.data(), (uint32_t)patch.size(), &patchedSize));
+	EXPECT_EQ(patchedSize, newSize);
+	EXPECT_EQ(oldBuffer, newBuffer);
+
+	BTableReadOnly patched(oldBuffer.data(), patchedSize);
+	ASSERT_TRUE(patched.validate());
+	EXPECT_EQ(patched.getValue<int16_t>(patched.getField("c"), 149, 1), 149);
+}
+
+TEST(BTableTest, CompactTypes)
+{
+	const uint32_t numEntries = 100;
+	BTable::FieldData fields[4];
+	fields[0].name = "flags";
+	fields[0].arraySize = 3;
+	fields[0].dataType = BTable::DataType::BOOL;
+	fields[1].name = "half";
+	fields[1].arraySize = 1;
+	fields[1].dataType = BTable::DataType::FLOAT16;
+	fields[2].name = "brain";
+	fields[2].arraySize = 1;
+	fields[2].dataType = BTable::DataType::BFLOAT16;
+	fields[3].name = "u16";
+	fields[3].arraySize = 1;
+	fields[3].dataType = BTable::DataType::UINT16;
+
+	// 300 bits padded to 40 bytes, 200 + 200 + 200 bytes, 16 + 4 * 8 header
+	uint32_t size = BTable::calculateBufferSize(fields, 4, numEntries);
+	EXPECT_EQ(size, 48u + 40 + 3 * 200);
+	std::vector<unsigned char> buffer(size);
+	BTable t(buffer.data(), size);
+	ASSERT_TRUE(t.init(fields, 4, numEntries));
+	ASSERT_TRUE(t.validate());
+
+	const BTable::FieldListEntry* flags = t.getField("flags");
+	for (uint32_t i = 0; i < numEntries; i++)
+	{
+		t.setValueBool(flags, i, i % 3 == 0, 0);
+		t.setValueBool(flags, i, true, 2);
+		t.setValueFloat16(t.getField("half"), i, (float)i * 0.5f);
+		t.setValueBFloat16(t.getField("brain"), i, (float)i * 256.0f);
+		t.setValue<uint16_t>(t.getField("u16"), i, (uint16_t)(60000 + i));
+	}
+	EXPECT_TRUE(t.getValueBool(flags, 99, 0));
+	EXPECT_FALSE(t.getValueBool(flags, 98, 0));
+	EXPECT_FALSE(t.getValueBool(flags, 98, 1));
+	EXPECT_EQ(t.countTrue(flags), 34u + 100);
+
+	// The generic accessors go through the bits of the entry, not the start of the column
+	t.setValue<bool>(flags, 7, true, 1);
+	EXPECT_TRUE(t.getValue<bool>(flags, 7, 1));
+	EXPECT_TRUE(t.getValueBool(flags, 0, 0));
+	EXPECT_FALSE(t.getValueBool(flags, 0, 1));
+	EXPECT_EQ(t.getValue<uint8_t>(flags, 98, 2), 1);
+	t.setValue<uint8_t>(flags, 7, 0, 1);
+	EXPECT_FALSE(t.getValueBool(flags, 7, 1));
+	EXPECT_EQ(t.countTrue(flags), 34u + 100);
+	EXPECT_EQ((const uint8_t*)((const BTable&)t).getValuePtr(flags, 50), (const uint8_t*)t.getEntries(flags) + 150 / 8);
+
+	// Bit-packed values have no byte address to scan or sum
+	uint32_t count = 1;
+	EXPECT_EQ((t.sumValues<uint8_t, uint32_t>(flags, nullptr, &count)), 0u);
+	EXPECT_EQ(count, 0u);
+	EXPECT_FALSE(t.forEachEntry(flags, [](const void*, uint32_t) {}));
+	EXPECT_EQ(t.getValueFloat16(t.getField("half"), 41), 20.5f);
+	EXPECT_EQ(t.getValueBFloat16(t.getField("brain"), 99), 25344.0f);
+	EXPECT_EQ(t.getValue<uint16_t>(t.getField("u16"), 99), 60099);
+
+	std::vector<float> values(numEntries);
+	ASSERT_TRUE(t.getFloatValues(t.getField("half"), 0, numEntries, values.data()));
+	EXPECT_EQ(values[99], 49.5f);
+	EXPECT_FALSE(t.getFloatValues(t.getField("u16"), 0, numEntries, values.data()));
+	EXPECT_FALSE(t.getFloatValues(t.getField("half"), 1, numEntries, values.data()));
+
+	// Rounding to nearest even, overflow, subnormals and NaN
+	EXPECT_EQ(BTable::floatToHalf(1.0f), 0x3C00);
+	EXPECT_EQ(BTable::floatToHalf(1.0f + 1.0f / 2048), 0x3C00);
+	EXPECT_EQ(BTable::floatToHalf(1.0f + 3.0f / 2048), 0x3C02);
+	EXPECT_EQ(BTable::floatToHalf(-65520.0f), 0xFC00);
+	EXPECT_EQ(BTable::floatToHalf(5.960464477539063e-8f), 0x0001);
+	EXPECT_EQ(BTable::halfToFloat(0x0001), 5.960464477539063e-8f);
+	EXPECT_EQ(BTable::halfToFloat(0xC000), -2.0f);
+	EXPECT_TRUE(std::isnan(BTable::halfToFloat(BTable::floatToHalf(NAN))));
+	EXPECT_EQ(BTable::floatToBFloat16(1.0f + 1.0f / 256), 0x3F80);
+	EXPECT_EQ(BTable::floatToBFloat16(1.0f + 3.0f / 256), 0x3F82);
+	EXPECT_TRUE(std::isnan(BTable::bfloat16ToFloat(BTable::floatToBFloat16(NAN))));
+
+	// Bit-packed lists are not supported
+	fields[0].list = true;
+	EXPECT_FALSE(t.init(fields, 1, numEntries));
+}
+
+TEST(BTableTest, Float16SoftwareConversion)
+{
+	auto floatBits = [](float f)
+	{
+		uint32_t bits;
+		memcpy(&bits, &f, 4);
+		return bits;
+	};
+	auto bitsFloat = [](uint32_t bits)
+	{
+		float f;
+		memcpy(&f, &bits, 4);
+		return f;
+	};
+
+	EXPECT_EQ(BTable::floatToHalfSoftware(1.0f + 1.0f / 2048), 0x3C00);
+	EXPECT_EQ(BTable::floatToHalfSoftware(1.0f + 3.0f / 2048), 0x3C02);
+	EXPECT_EQ(BTable::floatToHalfSoftware(65519.0f), 0x7BFF);
+	EXPECT_EQ(BTable::floatToHalfSoftware(-65520.0f), 0xFC00);
+	EXPECT_EQ(BTable::floatToHalfSoftware(5.960464477539063e-8f), 0x0001);
+	EXPECT_EQ(BTable::floatToHalfSoftware(2.9802322387695312e-8f), 0x0000);
+	EXPECT_EQ(floatBits(BTable::halfToFloatSoftware(0x0001)), floatBits(5.960464477539063e-8f));
+	EXPECT_EQ(floatBits(BTable::halfToFloatSoftware(0x8000)), 0x80000000u);
+
+	// NaNs keep their payload and are quieted
+	EXPECT_EQ(floatBits(BTable::halfToFloatSoftware(0x7C01)), 0x7FC02000u);
+	EXPECT_EQ(floatBits(BTable::halfToFloatSoftware(0xFE55)), 0xFFCAA000u);
+	EXPECT_EQ(BTable::floatToHalfSoftware(bitsFloat(0x7F802000)), 0x7E01);
+	EXPECT_EQ(BTable::floatToHalfSoftware(bitsFloat(0xFFC00001)), 0xFE00);
+
+	// Same results as the conversion in use, which is F16C where available
+	for (uint32_t h = 0; h < 0x10000; h++)
+	{
+		float f = BTable::halfToFloatSoftware((uint16_t)h);
+		ASSERT_EQ(floatBits(f), floatBits(BTable::halfToFloat((uint16_t)h)));
+		ASSERT_EQ(BTable::floatToHalfSoftware(f), BTable::floatToHalf(f));
+		ASSERT_EQ(BTable::floatToHalfSoftware(bitsFloat(floatBits(f) + 0x1000)), BTable::floatToHalf(bitsFloat(floatBits(f) + 0x1000)));
+	}
+
+	// Strided sweep over all float bit patterns, NaNs with payloads included
+	for (uint64_t bits = 0; bits <= 0xFFFFFFFFull; bits += 4099)
+	{
+		float f = bitsFloat((uint32_t)bits);
+		ASSERT_EQ(BTable::floatToHalfSoftware(f), BTable::floatToHalf(f));
+	}
+}
+
+TEST(BTableTest, CompactTypesInExpressionsAndArrow)
+{
+	const uint32_t numEntries = 70;
+	BTable::FieldData fields[3];
+	fields[0].name = "flag";
+	fields[0].arraySize = 1;
+	fields[0].dataType = BTable::DataType::BOOL;
+	fields[1].name = "half";
+	fields[1].arraySize = 1;
+	fields[1].dataType = BTable::DataType::FLOAT16;
+	fields[2].name = "out";
+	fields[2].arraySize = 1;
+	fields[2].dataType = BTable::DataType::BOOL;
+
+	std::vector<unsigned char> buffer(BTable::calculateBufferSize(fields, 3, numEntries));
+	BTable t(buffer.data(), (uint32_t)buffer.size());
+	ASSERT_TRUE(t.init(fields, 3, numEntries));
+	std::vector<float> halves(numEntries);
+	for (uint32_t i = 0; i < numEntries; i++)
+	{
+		t.setValueBool(t.getField("flag"), i, i % 2 == 1);
+		halves[i] = (float)i;
+	}
+	ASSERT_TRUE(t.setFloatValues(t.getField("half"), 0, numEntries, halves.data()));
+
+	// out = flag && half >= 60
+	BTableExpression e;
+	BTableExpression::Node predicate = e.logicalAnd(e.column(0), e.greaterEqual(e.column(1), e.constant(60.0)));
+	ASSERT_TRUE(e.materialize(t, predicate, t.getField("out")));
+	EXPECT_EQ(t.countTrue(t.getField("out")), 5u);
+	EXPECT_TRUE(t.getValueBool(t.getField("out"), 69));
+	EXPECT_FALSE(t.getValueBool(t.getField("out"), 68));
+
+	// BOOL exports as a shared bit-packed boolean array
+	ArrowSchema schema;
+	ArrowArray array;
+	ASSERT_TRUE(BTableArrow::exportColumn(t, t.getField("out"), &schema, &array));
+	EXPECT_STREQ(schema.format, "b");
+	EXPECT_EQ(array.buffers[1], t.getEntries(t.getField("out")));
+
+	std::vector<unsigned char> copyBuffer(buffer.size());
+	BTable copy(copyBuffer.data(), (uint32_t)copyBuffer.size());
+	ASSERT_TRUE(copy.init(fields, 3, numEntries));
+	ASSERT_TRUE(BTableArrow::importColumn(copy, copy.getField("out"), &schema, &array));
+	EXPECT_EQ(copy.countTrue(copy.getField("out")), 5u);
+	EXPECT_TRUE(copy.getValueBool(copy.getField("out"), 61));
+	schema.release(&schema);
+	array.release(&array);
+
+	ASSERT_TRUE(BTableArrow::exportColumn(t, t.getField("half"), &schema, &array));
+	EXPECT_STREQ(schema.format, "e");
+	schema.release(&schema);
+	array.release(&array);
+}